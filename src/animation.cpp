@@ -0,0 +1,143 @@
+// SPDX-License-Identifier: Apache-2.0
+// Copyright (C) 2020 Artem Senichev <artemsen@gmail.com>
+
+#include "animation.hpp"
+#include "file_data.hpp"
+#include "gif_decoder.hpp"
+
+#include <exception>
+
+/** @brief Number of frames in the ring. */
+constexpr size_t ring_size = 3;
+
+std::unique_ptr<animation> animation::create(const char* file, const image& first)
+{
+#ifdef HAVE_LIBGIF
+    if (!first.animated) {
+        return nullptr; // set by the loader for formats with animation
+    }
+    try {
+        std::unique_ptr<file_data> data(new file_data(file));
+        std::unique_ptr<gif_decoder> gif(new gif_decoder(data->data(), data->size()));
+        // pixels of the first frame are decoded only if the loaded image
+        // differs from the canvas (e.g. preview from the disk cache)
+        size_t delay;
+        if (!gif->next(delay, &first)) {
+            return nullptr;
+        }
+        return std::unique_ptr<animation>(new animation(std::move(data), std::move(gif), delay));
+    } catch (const std::exception&) {
+        return nullptr;
+    }
+#else
+    (void)file;
+    (void)first;
+    return nullptr;
+#endif // HAVE_LIBGIF
+}
+
+#ifdef HAVE_LIBGIF
+animation::animation(std::unique_ptr<file_data>&& data, std::unique_ptr<gif_decoder>&& gif,
+                     size_t delay)
+    : data_(std::move(data))
+    , gif_(std::move(gif))
+    , ring_(ring_size)
+{
+    // the ring starts with the first frame, the worker decodes the next ones
+    frame& frm = ring_[0];
+    frm.img = gif_->canvas();
+    frm.img.transparent = frm.img.has_transparency();
+    frm.img.animated = true;
+    frm.delay = delay;
+    ready_ = 1;
+
+    thread_ = std::thread(&animation::worker, this);
+}
+#endif // HAVE_LIBGIF
+
+animation::~animation()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stop_ = true;
+    }
+    cond_.notify_all();
+    if (thread_.joinable()) {
+        thread_.join();
+    }
+}
+
+bool animation::next(image& img, size_t& delay)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (!ready_) {
+        return false;
+    }
+    frame& frm = ring_[head_];
+    std::swap(img, frm.img);
+    delay = frm.delay;
+    head_ = (head_ + 1) % ring_.size();
+    --ready_;
+    cond_.notify_all();
+    return true;
+}
+
+bool animation::ready()
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    return ready_ != 0;
+}
+
+bool animation::finished()
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    return finished_ && !ready_;
+}
+
+void animation::worker()
+{
+#ifdef HAVE_LIBGIF
+    std::unique_lock<std::mutex> lock(mutex_);
+
+    while (!stop_) {
+        if (ready_ == ring_.size()) {
+            cond_.wait(lock);
+            continue;
+        }
+        frame& frm = ring_[(head_ + ready_) % ring_.size()];
+        lock.unlock();
+
+        size_t delay = 0;
+        bool decoded = false;
+        try {
+            decoded = gif_->next(delay);
+            if (!decoded && gif_->frames() > 1) {
+                // loop the animation
+                gif_->rewind();
+                decoded = gif_->next(delay);
+            }
+        } catch (const std::exception&) {
+            decoded = false;
+        }
+        if (decoded) {
+            // free buffer is reused, it has the same size as the canvas
+            const image& canvas = gif_->canvas();
+            frm.img.width = canvas.width;
+            frm.img.height = canvas.height;
+            frm.img.full_width = canvas.full_width;
+            frm.img.full_height = canvas.full_height;
+            frm.img.data = canvas.data;
+            frm.img.transparent = frm.img.has_transparency();
+            frm.img.animated = gif_->frames() == 1; // first frame
+            frm.delay = delay;
+        }
+
+        lock.lock();
+        if (!decoded) {
+            finished_ = true;
+            break;
+        }
+        ++ready_;
+    }
+#endif // HAVE_LIBGIF
+}
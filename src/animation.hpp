@@ -0,0 +1,109 @@
+// SPDX-License-Identifier: Apache-2.0
+// Copyright (C) 2020 Artem Senichev <artemsen@gmail.com>
+
+#pragma once
+
+#include "image.hpp"
+
+#include <atomic>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+class file_data;
+class gif_decoder;
+
+/**
+ * @class animation
+ * @brief Animation player: frames are decoded in background into a small
+ *        ring of ready frames, so only a few frames are kept in memory.
+ */
+class animation {
+public:
+    /**
+     * @brief Create animation player for the file.
+     *
+     * @param[in] file path to the image file
+     * @param[in] first first frame decoded by the image loader, the player
+     *                  starts with it instead of decoding the frame again
+     *
+     * @return player instance or nullptr if the file format doesn't support
+     *         animation or can't be decoded
+     */
+    static std::unique_ptr<animation> create(const char* file, const image& first);
+
+    ~animation();
+
+    /**
+     * @brief Get the next frame if it is ready.
+     *
+     * @param[in,out] frame image to swap the frame with, its buffer is reused
+     *                      for the next frames
+     * @param[out] delay frame delay in milliseconds
+     *
+     * @return false if the frame is not ready yet
+     */
+    bool next(image& frame, size_t& delay);
+
+    /**
+     * @brief Check if the next frame is ready, so next() will succeed.
+     *        Ready frames are consumed only by next(), so the result stays
+     *        valid for the thread that calls both.
+     *
+     * @return true if the next frame is ready
+     */
+    bool ready();
+
+    /**
+     * @brief Check if animation is finished: the image has a single frame
+     *        or decoding failed, so there is nothing to play.
+     *
+     * @return true if animation is finished
+     */
+    bool finished();
+
+private:
+#ifdef HAVE_LIBGIF
+    animation(std::unique_ptr<file_data>&& data, std::unique_ptr<gif_decoder>&& gif,
+              size_t delay);
+#endif // HAVE_LIBGIF
+
+    /**
+     * @brief Background decoder.
+     */
+    void worker();
+
+private:
+    /** @brief Ready frame. */
+    struct frame {
+        image img;
+        size_t delay;
+    };
+
+    /** @brief Image file data. */
+    std::unique_ptr<file_data> data_;
+#ifdef HAVE_LIBGIF
+    /** @brief Frame decoder. */
+    std::unique_ptr<gif_decoder> gif_;
+#endif // HAVE_LIBGIF
+
+    /** @brief Ring of frames: ready ones and free buffers. */
+    std::vector<frame> ring_;
+    /** @brief Index of the first ready frame. */
+    size_t head_ = 0;
+    /** @brief Number of ready frames. */
+    size_t ready_ = 0;
+    /** @brief Flag indicated that animation is finished. */
+    bool finished_ = false;
+
+    /** @brief Background decoder thread. */
+    std::thread thread_;
+    /** @brief Flag used to stop background decoder. */
+    std::atomic<bool> stop_ { false };
+    /** @brief Lock of the ring state. */
+    std::mutex mutex_;
+    /** @brief Condition used to wake up the decoder. */
+    std::condition_variable cond_;
+};
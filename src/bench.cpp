@@ -0,0 +1,194 @@
+// SPDX-License-Identifier: Apache-2.0
+// Copyright (C) 2020 Artem Senichev <artemsen@gmail.com>
+
+#include "bench.hpp"
+#include "cpu.hpp"
+#include "file_data.hpp"
+#include "image_ldr.hpp"
+#include "thread_pool.hpp"
+#include "x11.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <exception>
+#include <memory>
+
+#include <sys/resource.h>
+
+/** @brief Number of runs of each stage, the best time is reported. */
+constexpr size_t bench_runs = 3;
+/** @brief Scales used for resize benchmark (percent). */
+static const size_t bench_scales[] = { 25, 50, 100, 200 };
+
+/** @brief Result of the single stage. */
+struct stage_result {
+    std::string file;  ///< Path to the image file
+    std::string stage; ///< Stage name
+    double ms;         ///< Best time (milliseconds)
+    double mpps;       ///< Throughput (megapixels of the output per second)
+    size_t rss;        ///< Peak resident set size after the stage (bytes)
+};
+
+/**
+ * @brief Get peak resident set size of the process.
+ *
+ * @return size in bytes
+ */
+static size_t peak_rss()
+{
+    rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return static_cast<size_t>(usage.ru_maxrss) * 1024;
+}
+
+/**
+ * @brief Execute the stage several times and save its best time.
+ *
+ * @param[in] file path to the image file
+ * @param[in] stage stage name
+ * @param[in] pixels number of pixels produced by the stage
+ * @param[in] fn stage handler
+ * @param[out] results list of results to append to
+ */
+template <typename F>
+static void measure(const std::string& file, const std::string& stage, size_t pixels,
+                    F fn, std::vector<stage_result>& results)
+{
+    using clock = std::chrono::steady_clock;
+    double best = 0;
+    for (size_t i = 0; i < bench_runs; ++i) {
+        const clock::time_point start = clock::now();
+        fn();
+        const std::chrono::duration<double, std::milli> ms = clock::now() - start;
+        if (i == 0 || ms.count() < best) {
+            best = ms.count();
+        }
+    }
+    const double mpps = best > 0 ? pixels / best / 1000.0 : 0;
+    results.push_back(stage_result { file, stage, best, mpps, peak_rss() });
+}
+
+/**
+ * @brief Print string as JSON literal.
+ *
+ * @param[in] str string to print
+ */
+static void print_json_str(const std::string& str)
+{
+    putchar('"');
+    for (char ch : str) {
+        if (ch == '"' || ch == '\\') {
+            printf("\\%c", ch);
+        } else if (static_cast<unsigned char>(ch) < 0x20) {
+            printf("\\u%04x", ch);
+        } else {
+            putchar(ch);
+        }
+    }
+    putchar('"');
+}
+
+/**
+ * @brief Print benchmark report.
+ *
+ * @param[in] results list of stage results
+ * @param[in] put name of the frame transport
+ * @param[in] json print report in JSON format
+ */
+static void print_report(const std::vector<stage_result>& results, const char* put, bool json)
+{
+    const char* isa = cpu_isa_name();
+
+    if (json) {
+        puts("[");
+        for (size_t i = 0; i < results.size(); ++i) {
+            const stage_result& res = results[i];
+            printf("  { \"file\": ");
+            print_json_str(res.file);
+            printf(", \"stage\": ");
+            print_json_str(res.stage);
+            printf(", \"isa\": \"%s\", \"put\": \"%s\"", isa, put);
+            printf(", \"ms\": %.3f, \"mpps\": %.1f, \"rss\": %zu }%s\n",
+                   res.ms, res.mpps, res.rss, i + 1 == results.size() ? "" : ",");
+        }
+        puts("]");
+        return;
+    }
+
+    printf("Kernels: %s, frame transport: %s\n", isa, put);
+    const std::string* file = nullptr;
+    for (auto& it : results) {
+        if (!file || *file != it.file) {
+            file = &it.file;
+            printf("%s\n", file->c_str());
+        }
+        printf("  %-16s %10.3f ms %10.1f MP/s %8zu MiB RSS\n", it.stage.c_str(),
+               it.ms, it.mpps, it.rss / (1024 * 1024));
+    }
+}
+
+bool bench(const std::vector<std::string>& files, scale_filter filter,
+           size_t threads, bool json)
+{
+    thread_pool::init(threads);
+
+    // window is optional: the present stage is skipped without X server
+    std::unique_ptr<x11> wnd(new x11());
+    try {
+        wnd->create(0);
+        wnd->sync();
+    } catch (const std::exception& ex) {
+        fprintf(stderr, "Present stage skipped: %s\n", ex.what());
+        wnd.reset();
+    }
+
+    bool rc = true;
+    std::vector<stage_result> results;
+    for (auto& file : files) {
+        image img;
+        try {
+            // decode from memory to exclude the file I/O, the first
+            // decoding is a warm up to get the image size
+            const file_data fd(file.c_str());
+            load_image(fd.data(), fd.size(), img, load_progress_fn());
+            measure(file, "decode", img.width * img.height, [&]() {
+                image tmp;
+                load_image(fd.data(), fd.size(), tmp, load_progress_fn());
+            }, results);
+        } catch (const std::exception& ex) {
+            fprintf(stderr, "Unable to load file %s: %s\n", file.c_str(), ex.what());
+            rc = false;
+            continue;
+        }
+        if (img.transparent) {
+            img.transparent = img.has_transparency();
+        }
+
+        for (size_t scale : bench_scales) {
+            const size_t pixels = (img.width * scale / 100) * (img.height * scale / 100);
+            measure(file, "resize " + std::to_string(scale) + '%', pixels,
+                    [&]() { img.resize(scale, filter); }, results);
+        }
+
+        measure(file, "add_grid", img.width * img.height,
+                [&]() { img.add_grid(); }, results);
+
+        if (wnd) {
+            // put the part of the image that fits the window
+            const size_t w = std::min(img.width, wnd->width());
+            const size_t h = std::min(img.height, wnd->height());
+            const image frame = img.resize(img.width, img.height, 0, 0, w, h, filter);
+            measure(file, "present", w * h, [&]() {
+                wnd->set_image(frame, 0, 0);
+                wnd->update_frame(0, h);
+                wnd->sync();
+            }, results);
+        }
+    }
+
+    // SHM can be disabled on the first frame if the segment is not attached
+    const char* put = !wnd ? "none" : wnd->shm() ? "xshm" : "xputimage";
+    print_report(results, put, json);
+    return rc;
+}
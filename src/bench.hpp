@@ -0,0 +1,24 @@
+// SPDX-License-Identifier: Apache-2.0
+// Copyright (C) 2020 Artem Senichev <artemsen@gmail.com>
+
+#pragma once
+
+#include "image_scale.hpp"
+
+#include <string>
+#include <vector>
+
+/**
+ * @brief Run benchmark of the image processing stages: decoding, scaling
+ *        with a sweep of scales, background compositing and putting the
+ *        frame to the X window. Report is printed to stdout.
+ *
+ * @param[in] files list of files to benchmark
+ * @param[in] filter scale filter to use
+ * @param[in] threads number of image processing threads (0 = auto)
+ * @param[in] json print report in JSON format instead of text
+ *
+ * @return false if any file can't be loaded
+ */
+bool bench(const std::vector<std::string>& files, scale_filter filter,
+           size_t threads, bool json);
@@ -0,0 +1,63 @@
+// SPDX-License-Identifier: Apache-2.0
+// Copyright (C) 2020 Artem Senichev <artemsen@gmail.com>
+
+#include "cpu.hpp"
+
+#include <cstdlib>
+#include <cstring>
+
+/** @brief Names of the instruction sets, indexed by cpu_isa. */
+static const char* isa_names[] = { "scalar", "sse2", "ssse3", "avx2" };
+
+/**
+ * @brief Get the best instruction set allowed by the environment.
+ *
+ * @return instruction set limit
+ */
+static cpu_isa isa_limit()
+{
+    const char* env = getenv("PICTERM_ISA");
+    if (env && *env) {
+        for (size_t i = 0; i < sizeof(isa_names) / sizeof(isa_names[0]); ++i) {
+            if (strcmp(env, isa_names[i]) == 0) {
+                return static_cast<cpu_isa>(i);
+            }
+        }
+    }
+    return cpu_isa::avx2;
+}
+
+bool cpu_supports(cpu_isa isa)
+{
+    static const cpu_isa limit = isa_limit();
+    if (isa > limit) {
+        return false;
+    }
+
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_cpu_init();
+    switch (isa) {
+        case cpu_isa::scalar:
+            return true;
+        case cpu_isa::sse2:
+            return __builtin_cpu_supports("sse2");
+        case cpu_isa::ssse3:
+            return __builtin_cpu_supports("ssse3");
+        case cpu_isa::avx2:
+            return __builtin_cpu_supports("avx2");
+    }
+    return false;
+#else
+    return isa == cpu_isa::scalar;
+#endif
+}
+
+const char* cpu_isa_name()
+{
+    for (size_t i = sizeof(isa_names) / sizeof(isa_names[0]) - 1; i > 0; --i) {
+        if (cpu_supports(static_cast<cpu_isa>(i))) {
+            return isa_names[i];
+        }
+    }
+    return isa_names[0];
+}
@@ -0,0 +1,30 @@
+// SPDX-License-Identifier: Apache-2.0
+// Copyright (C) 2020 Artem Senichev <artemsen@gmail.com>
+
+#pragma once
+
+/** @brief Instruction set extensions used by the image processing kernels. */
+enum class cpu_isa {
+    scalar, ///< Generic code only
+    sse2,   ///< SSE2
+    ssse3,  ///< SSSE3 (implies SSE2)
+    avx2    ///< AVX2 (implies all above)
+};
+
+/**
+ * @brief Check if the kernels can use the instruction set: it must be
+ *        supported by CPU and not limited by the PICTERM_ISA environment
+ *        variable (scalar, sse2, ssse3 or avx2, used to compare kernels).
+ *
+ * @param[in] isa instruction set to check
+ *
+ * @return true if the instruction set can be used
+ */
+bool cpu_supports(cpu_isa isa);
+
+/**
+ * @brief Get name of the best instruction set used by the kernels.
+ *
+ * @return instruction set name
+ */
+const char* cpu_isa_name();
@@ -0,0 +1,345 @@
+// SPDX-License-Identifier: Apache-2.0
+// Copyright (C) 2020 Artem Senichev <artemsen@gmail.com>
+
+#include "daemon.hpp"
+
+#include <cerrno>
+#include <climits>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <stdexcept>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+// Protocol: the client sends a request as a set of text lines:
+//   window <id>     parent window id (optional, focused window by default)
+//   file <path>     absolute path to the file to show (one or more)
+//   show            end of the request
+// The daemon shows the images and replies when the window is closed:
+//   ok              images were shown
+//   error <text>    unable to show images
+
+/** @brief Timeout for reading the request from the client (seconds). */
+constexpr time_t request_timeout = 5;
+/** @brief Max size of the request. */
+constexpr size_t request_max = 1024 * 1024;
+
+/**
+ * @brief Check the directory is accessible by the current user only.
+ *
+ * @param[in] dir path to the directory
+ *
+ * @return true if the directory is private
+ */
+static bool private_dir(const std::string& dir)
+{
+    struct stat st;
+    return lstat(dir.c_str(), &st) == 0 && S_ISDIR(st.st_mode) &&
+        st.st_uid == getuid() && (st.st_mode & (S_IRWXG | S_IRWXO)) == 0;
+}
+
+/**
+ * @brief Get path to the daemon socket, the socket is placed in a private
+ *        directory so other users can't replace it.
+ *
+ * @param[in] create create the fallback directory if it doesn't exist
+ *
+ * @return path to the socket, empty if there is no private directory
+ */
+static std::string socket_path(bool create)
+{
+    std::string dir;
+    const char* runtime = getenv("XDG_RUNTIME_DIR");
+    if (runtime && *runtime) {
+        dir = runtime;
+    } else {
+        dir = "/tmp/picterm-" + std::to_string(getuid());
+        if (create) {
+            mkdir(dir.c_str(), S_IRWXU); // checked below
+        }
+    }
+    if (!private_dir(dir)) {
+        return std::string();
+    }
+    return dir + "/picterm.sock";
+}
+
+/**
+ * @brief Create socket address.
+ *
+ * @param[in] path path to the socket
+ * @param[out] addr address to fill
+ *
+ * @return false if the socket path is empty or too long
+ */
+static bool socket_addr(const std::string& path, sockaddr_un& addr)
+{
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (path.empty() || path.length() >= sizeof(addr.sun_path)) {
+        return false;
+    }
+    memcpy(addr.sun_path, path.c_str(), path.length());
+    return true;
+}
+
+/**
+ * @brief Check the peer process is run by the current user.
+ *
+ * @param[in] fd connected socket descriptor
+ *
+ * @return true if the peer is trusted
+ */
+static bool peer_trusted(int fd)
+{
+    ucred cred;
+    socklen_t len = sizeof(cred);
+    return getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &cred, &len) == 0 &&
+        cred.uid == getuid();
+}
+
+/**
+ * @brief Connect to the daemon.
+ *
+ * @return socket descriptor, -1 if the daemon is not running or the socket
+ *         belongs to another user
+ */
+static int socket_connect()
+{
+    const std::string path = socket_path(false);
+    sockaddr_un addr;
+    if (!socket_addr(path, addr)) {
+        return -1;
+    }
+    struct stat st;
+    if (lstat(path.c_str(), &st) != 0 || !S_ISSOCK(st.st_mode) || st.st_uid != getuid()) {
+        return -1;
+    }
+    const int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd == -1) {
+        return -1;
+    }
+    if (connect(fd, reinterpret_cast<const sockaddr*>(&addr), sizeof(addr)) == -1 ||
+        !peer_trusted(fd)) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+/**
+ * @brief Write the whole buffer to the socket.
+ *
+ * @param[in] fd socket descriptor
+ * @param[in] msg message to send
+ *
+ * @return false on errors
+ */
+static bool send_all(int fd, const std::string& msg)
+{
+    size_t pos = 0;
+    while (pos < msg.length()) {
+        const ssize_t rc = send(fd, msg.data() + pos, msg.length() - pos, MSG_NOSIGNAL);
+        if (rc == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return false;
+        }
+        pos += static_cast<size_t>(rc);
+    }
+    return true;
+}
+
+/**
+ * @brief Read socket until the final line of the message.
+ *
+ * @param[in] fd socket descriptor
+ * @param[in] last predicate to check the line is the final one
+ * @param[out] lines received lines, the final one is included
+ *
+ * @return false on errors or if the connection is closed
+ */
+template <typename T>
+static bool recv_lines(int fd, T last, std::vector<std::string>& lines)
+{
+    std::string buf;
+    size_t total = 0;
+    char chunk[4096];
+    while (true) {
+        const ssize_t rc = recv(fd, chunk, sizeof(chunk), 0);
+        if (rc == -1 && errno == EINTR) {
+            continue;
+        }
+        if (rc <= 0) {
+            return false;
+        }
+        total += static_cast<size_t>(rc);
+        if (total > request_max) {
+            return false;
+        }
+        buf.append(chunk, static_cast<size_t>(rc));
+        size_t pos;
+        while ((pos = buf.find('\n')) != std::string::npos) {
+            lines.push_back(buf.substr(0, pos));
+            buf.erase(0, pos + 1);
+            if (last(lines.back())) {
+                return true;
+            }
+        }
+    }
+}
+
+/**
+ * @brief Serve single client request.
+ *
+ * @param[in] view viewer to use
+ * @param[in] fd client socket descriptor
+ */
+static void serve(viewer& view, int fd)
+{
+    std::vector<std::string> lines;
+    if (!recv_lines(fd, [](const std::string& line) { return line == "show"; }, lines)) {
+        return;
+    }
+
+    std::string window;
+    view.files.clear();
+    for (const std::string& line : lines) {
+        if (line.compare(0, 7, "window ") == 0) {
+            window = line.substr(7);
+        } else if (line.compare(0, 5, "file ") == 0) {
+            view.files.push_back(line.substr(5));
+        }
+    }
+    if (view.files.empty()) {
+        send_all(fd, "error No files to show\n");
+        return;
+    }
+    if (window.empty()) {
+        unsetenv("WINDOWID");
+    } else {
+        setenv("WINDOWID", window.c_str(), 1);
+    }
+
+    std::string reply = "ok\n";
+    view.watch(fd); // close the window if the client is gone
+    try {
+        view.show();
+    } catch (std::exception& ex) {
+        view.close();
+        reply = "error Unable to preview file " + view.current_file() + ": " + ex.what() + "\n";
+    }
+    view.watch(-1);
+    send_all(fd, reply);
+}
+
+void daemon_run(viewer& view)
+{
+    const std::string path = socket_path(true);
+    if (path.empty()) {
+        throw std::runtime_error("Unable to get private directory for the socket");
+    }
+    sockaddr_un addr;
+    if (!socket_addr(path, addr)) {
+        throw std::runtime_error("Socket path is too long");
+    }
+
+    int fd = socket_connect();
+    if (fd != -1) {
+        close(fd);
+        throw std::runtime_error("Daemon is already running");
+    }
+
+    fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd == -1) {
+        throw std::runtime_error(std::string("Unable to create socket: ") + strerror(errno));
+    }
+    unlink(addr.sun_path); // remove stale socket
+    const mode_t mask = umask(S_IRWXG | S_IRWXO); // socket for the owner only
+    const int bound = bind(fd, reinterpret_cast<const sockaddr*>(&addr), sizeof(addr));
+    umask(mask);
+    if (bound == -1 || listen(fd, 8) == -1) {
+        const int err = errno;
+        close(fd);
+        throw std::runtime_error(std::string("Unable to bind socket ") + addr.sun_path +
+                                 ": " + strerror(err));
+    }
+
+    view.persistent = true;
+    x11::trap_errors(); // errors of a single request must not kill the daemon
+
+    // requests are served one by one: the viewer has the only window
+    while (true) {
+        const int client = accept4(fd, nullptr, nullptr, SOCK_CLOEXEC);
+        if (client == -1) {
+            if (errno == EINTR || errno == ECONNABORTED) {
+                continue;
+            }
+            const int err = errno;
+            close(fd);
+            unlink(addr.sun_path);
+            throw std::runtime_error(std::string("Unable to accept connection: ") + strerror(err));
+        }
+        if (!peer_trusted(client)) {
+            close(client);
+            continue;
+        }
+        // don't let a stalled client block the daemon
+        timeval tv;
+        tv.tv_sec = request_timeout;
+        tv.tv_usec = 0;
+        setsockopt(client, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+
+        serve(view, client);
+        close(client);
+    }
+}
+
+bool client_run(const std::vector<std::string>& files, bool& rc)
+{
+    std::string request;
+    const char* window = getenv("WINDOWID");
+    if (window && *window) {
+        request += "window ";
+        request += window;
+        request += '\n';
+    }
+    for (const std::string& file : files) {
+        // the daemon has its own working directory
+        char path[PATH_MAX];
+        if (!realpath(file.c_str(), path) || strchr(path, '\n')) {
+            return false; // let the caller report the error
+        }
+        request += "file ";
+        request += path;
+        request += '\n';
+    }
+    request += "show\n";
+
+    const int fd = socket_connect();
+    if (fd == -1) {
+        return false;
+    }
+
+    std::vector<std::string> reply;
+    if (!send_all(fd, request) ||
+        !recv_lines(fd, [](const std::string&) { return true; }, reply)) {
+        close(fd);
+        fprintf(stderr, "Connection to the daemon is lost\n");
+        rc = false;
+        return true;
+    }
+    close(fd);
+
+    rc = reply[0] == "ok";
+    if (!rc) {
+        const std::string& msg = reply[0];
+        fprintf(stderr, "%s\n", msg.compare(0, 6, "error ") == 0 ? msg.c_str() + 6 : msg.c_str());
+    }
+    return true;
+}
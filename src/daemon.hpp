@@ -0,0 +1,31 @@
+// SPDX-License-Identifier: Apache-2.0
+// Copyright (C) 2020 Artem Senichev <artemsen@gmail.com>
+
+#pragma once
+
+#include "viewer.hpp"
+
+#include <string>
+#include <vector>
+
+/**
+ * @brief Run the viewer as a daemon: requests to show images are read from
+ *        the Unix socket and served one by one with the same viewer, so the
+ *        X connection, thread pool and image caches are reused.
+ *
+ * @param[in] view viewer to use
+ *
+ * @throw std::exception if the socket can't be created
+ */
+void daemon_run(viewer& view);
+
+/**
+ * @brief Send request to show images to the daemon and wait until the
+ *        window is closed.
+ *
+ * @param[in] files list of files to show
+ * @param[out] rc true if the images were shown successfully
+ *
+ * @return false if the daemon is not running
+ */
+bool client_run(const std::vector<std::string>& files, bool& rc);
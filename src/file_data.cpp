@@ -0,0 +1,88 @@
+// SPDX-License-Identifier: Apache-2.0
+// Copyright (C) 2020 Artem Senichev <artemsen@gmail.com>
+
+#include "file_data.hpp"
+
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <system_error>
+#include <unistd.h>
+
+/** @brief Size of the block used to read non-mappable sources. */
+constexpr size_t read_block = 64 * 1024;
+
+constexpr const char* file_data::stdin_name;
+
+file_data::file_data(const char* file)
+{
+    if (strcmp(file, stdin_name) == 0) {
+        read_all(STDIN_FILENO);
+        return;
+    }
+
+    const int fd = open(file, O_RDONLY | O_CLOEXEC);
+    if (fd == -1) {
+        throw std::system_error(errno, std::system_category());
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) == -1) {
+        const int err = errno;
+        close(fd);
+        throw std::system_error(err, std::system_category());
+    }
+
+    if (S_ISREG(st.st_mode) && st.st_size > 0) {
+        void* map = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (map != MAP_FAILED) {
+            // decoders read the file from start to end
+            madvise(map, st.st_size, MADV_SEQUENTIAL);
+            data_ = static_cast<const uint8_t*>(map);
+            size_ = st.st_size;
+            mapped_ = true;
+            close(fd);
+            return;
+        }
+    }
+
+    // not mappable (pipe, device, etc)
+    try {
+        read_all(fd);
+    } catch (const std::exception&) {
+        close(fd);
+        throw;
+    }
+    close(fd);
+}
+
+file_data::~file_data()
+{
+    if (mapped_) {
+        munmap(const_cast<uint8_t*>(data_), size_);
+    }
+}
+
+void file_data::read_all(int fd)
+{
+    size_t size = 0;
+    for (;;) {
+        buffer_.resize(size + read_block);
+        const ssize_t rc = read(fd, &buffer_[size], read_block);
+        if (rc == 0) {
+            break;
+        }
+        if (rc < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            throw std::system_error(errno, std::system_category());
+        }
+        size += rc;
+    }
+    buffer_.resize(size);
+    data_ = buffer_.data();
+    size_ = size;
+}
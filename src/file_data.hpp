@@ -0,0 +1,69 @@
+// SPDX-License-Identifier: Apache-2.0
+// Copyright (C) 2020 Artem Senichev <artemsen@gmail.com>
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+/**
+ * @class file_data
+ * @brief Content of the file loaded into memory.
+ *
+ * Regular files are mapped into memory, other sources (stdin, pipes,
+ * character devices) are read into the buffer.
+ */
+class file_data {
+public:
+    /** @brief Name of the file used to read data from stdin. */
+    static constexpr const char* stdin_name = "-";
+
+    /**
+     * @brief Constructor: load the file.
+     *
+     * @param[in] file path to the file to load, "-" for stdin
+     *
+     * @throw std::system_error if file operation fails
+     */
+    file_data(const char* file);
+
+    ~file_data();
+
+    file_data(const file_data&) = delete;
+    file_data& operator=(const file_data&) = delete;
+
+    /**
+     * @brief Get file content.
+     *
+     * @return pointer to the first byte of data
+     */
+    const uint8_t* data() const { return data_; }
+
+    /**
+     * @brief Get size of the file content.
+     *
+     * @return size of data in bytes
+     */
+    size_t size() const { return size_; }
+
+private:
+    /**
+     * @brief Read the whole stream into the buffer.
+     *
+     * @param[in] fd file descriptor to read
+     *
+     * @throw std::system_error if read operation fails
+     */
+    void read_all(int fd);
+
+private:
+    /** @brief File content. */
+    const uint8_t* data_ = nullptr;
+    /** @brief Size of the file content. */
+    size_t size_ = 0;
+    /** @brief Flag indicated that the data is mapped. */
+    bool mapped_ = false;
+    /** @brief Buffer for the data of non-mappable sources. */
+    std::vector<uint8_t> buffer_;
+};
@@ -0,0 +1,279 @@
+// SPDX-License-Identifier: Apache-2.0
+// Copyright (C) 2020 Artem Senichev <artemsen@gmail.com>
+
+#include "gif_decoder.hpp"
+#include "cpu.hpp"
+#include "image_convert.hpp"
+
+#ifdef HAVE_LIBGIF
+#include <gif_lib.h>
+
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define GIF_X86
+#include <immintrin.h>
+#endif
+
+using rgba_t = image::rgba_t;
+
+/** @brief Default frame delay (ms), used if it is not specified. */
+constexpr size_t default_delay = 100;
+
+/** @brief Size of the palette (max number of colors). */
+constexpr size_t palette_size = 256;
+
+/**
+ * @brief Expand row of color indices to pixels, transparent pixels (zero
+ *        entries of the palette) leave the destination unchanged.
+ *
+ * @param[in] src color indices
+ * @param[in] lut palette
+ * @param[in,out] dst destination row
+ * @param[in] w number of pixels in the row
+ */
+static void expand_row(const uint8_t* src, const rgba_t* lut, rgba_t* dst, size_t w)
+{
+    for (size_t i = 0; i < w; ++i) {
+        const rgba_t px = lut[src[i]];
+        dst[i] = px ? px : dst[i];
+    }
+}
+
+#ifdef GIF_X86
+__attribute__((target("avx2")))
+static void expand_row_avx2(const uint8_t* src, const rgba_t* lut, rgba_t* dst, size_t w)
+{
+    const int* base = reinterpret_cast<const int*>(lut);
+    const __m256i zero = _mm256_setzero_si256();
+    size_t i = 0;
+    for (; i + 8 <= w; i += 8) {
+        const __m256i idx = _mm256_cvtepu8_epi32(
+            _mm_loadl_epi64(reinterpret_cast<const __m128i*>(src + i)));
+        const __m256i px = _mm256_i32gather_epi32(base, idx, sizeof(rgba_t));
+        const __m256i old = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(dst + i));
+        const __m256i mask = _mm256_cmpeq_epi32(px, zero);
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + i),
+                            _mm256_blendv_epi8(px, old, mask));
+    }
+    expand_row(src + i, lut, dst + i, w - i);
+}
+#endif // GIF_X86
+
+/** @brief Row expansion kernel. */
+using expand_fn = void (*)(const uint8_t*, const rgba_t*, rgba_t*, size_t);
+
+/**
+ * @brief Get the fastest row expansion kernel supported by CPU.
+ */
+static expand_fn select_expand()
+{
+#ifdef GIF_X86
+    if (cpu_supports(cpu_isa::avx2)) {
+        return expand_row_avx2;
+    }
+#endif // GIF_X86
+    return expand_row;
+}
+
+gif_decoder::gif_decoder(const uint8_t* data, size_t size)
+    : data_(data)
+    , size_(size)
+{
+    open();
+}
+
+gif_decoder::~gif_decoder()
+{
+    close();
+}
+
+void gif_decoder::open()
+{
+    int err = 0;
+    pos_ = 0;
+    gif_ = DGifOpen(this, &gif_decoder::read, &err);
+    if (!gif_) {
+        throw std::runtime_error(GifErrorString(err));
+    }
+    if (gif_->SWidth <= 0 || gif_->SHeight <= 0) {
+        close();
+        throw std::runtime_error("Invalid GIF screen size");
+    }
+
+    canvas_.width = gif_->SWidth;
+    canvas_.height = gif_->SHeight;
+    canvas_.full_width = canvas_.width;
+    canvas_.full_height = canvas_.height;
+    canvas_.transparent = true;
+    canvas_.data.assign(canvas_.width * canvas_.height, 0);
+
+    frames_ = 0;
+    disposal_ = DISPOSAL_UNSPECIFIED;
+    prev_w_ = prev_h_ = 0;
+}
+
+void gif_decoder::close()
+{
+    if (gif_) {
+        DGifCloseFile(gif_, nullptr);
+        gif_ = nullptr;
+    }
+}
+
+void gif_decoder::rewind()
+{
+    close();
+    open();
+}
+
+int gif_decoder::read(GifFileType* gif, uint8_t* buffer, int size)
+{
+    gif_decoder* self = static_cast<gif_decoder*>(gif->UserData);
+    const size_t sz = std::min(static_cast<size_t>(size), self->size_ - self->pos_);
+    memcpy(buffer, self->data_ + self->pos_, sz);
+    self->pos_ += sz;
+    return sz;
+}
+
+void gif_decoder::dispose()
+{
+    if (disposal_ == DISPOSE_BACKGROUND) {
+        // background is transparent
+        for (size_t y = prev_y_; y < prev_y_ + prev_h_; ++y) {
+            rgba_t* row = &canvas_.data[y * canvas_.width + prev_x_];
+            std::fill(row, row + prev_w_, 0);
+        }
+    } else if (disposal_ == DISPOSE_PREVIOUS && !saved_.empty()) {
+        canvas_.data.swap(saved_);
+    }
+}
+
+bool gif_decoder::next(size_t& delay, const image* decoded /*= nullptr*/)
+{
+    GraphicsControlBlock gcb;
+    gcb.DisposalMode = DISPOSAL_UNSPECIFIED;
+    gcb.DelayTime = 0;
+    gcb.TransparentColor = NO_TRANSPARENT_COLOR;
+
+    for (;;) {
+        GifRecordType type;
+        if (DGifGetRecordType(gif_, &type) != GIF_OK) {
+            throw std::runtime_error(GifErrorString(gif_->Error));
+        }
+
+        if (type == TERMINATE_RECORD_TYPE) {
+            return false;
+        }
+
+        if (type == EXTENSION_RECORD_TYPE) {
+            int code;
+            GifByteType* ext;
+            if (DGifGetExtension(gif_, &code, &ext) != GIF_OK) {
+                throw std::runtime_error(GifErrorString(gif_->Error));
+            }
+            if (code == GRAPHICS_EXT_FUNC_CODE && ext) {
+                DGifExtensionToGCB(ext[0], ext + 1, &gcb);
+            }
+            while (ext) {
+                if (DGifGetExtensionNext(gif_, &ext) != GIF_OK) {
+                    throw std::runtime_error(GifErrorString(gif_->Error));
+                }
+            }
+            continue;
+        }
+
+        if (type != IMAGE_DESC_RECORD_TYPE) {
+            continue;
+        }
+
+        if (DGifGetImageDesc(gif_) != GIF_OK) {
+            throw std::runtime_error(GifErrorString(gif_->Error));
+        }
+        break;
+    }
+
+    const GifImageDesc& desc = gif_->Image;
+    const ColorMapObject* clr_map = desc.ColorMap ? desc.ColorMap : gif_->SColorMap;
+    if (!clr_map) {
+        throw std::runtime_error("GIF color map not found");
+    }
+
+    // palette with transparent color as zero entry
+    rgba_t lut[palette_size] = { 0 };
+    const size_t colors = std::min(static_cast<size_t>(clr_map->ColorCount), palette_size);
+    static_assert(sizeof(GifColorType) == 3, "Unexpected GifColorType layout");
+    convert_row<pixel_layout::rgb>(reinterpret_cast<const uint8_t*>(clr_map->Colors), lut, colors);
+    if (gcb.TransparentColor >= 0 && static_cast<size_t>(gcb.TransparentColor) < palette_size) {
+        lut[gcb.TransparentColor] = 0;
+    }
+
+    dispose();
+
+    if (gcb.DisposalMode == DISPOSE_PREVIOUS) {
+        saved_ = canvas_.data;
+    }
+
+    // frame area clipped by the canvas
+    const size_t frame_x = std::min(static_cast<size_t>(desc.Left), canvas_.width);
+    const size_t frame_y = std::min(static_cast<size_t>(desc.Top), canvas_.height);
+    const size_t frame_w = desc.Width;
+    const size_t frame_h = desc.Height;
+    const size_t width = std::min(frame_w, canvas_.width - frame_x);
+
+    // rows order for interlaced images: 4 passes with different steps
+    static const size_t pass_offset[] = { 0, 4, 2, 1 };
+    static const size_t pass_step[] = { 8, 8, 4, 2 };
+    const size_t passes = desc.Interlace ? 4 : 1;
+
+    static const expand_fn expand = select_expand();
+
+    const bool skip = decoded && decoded->width == canvas_.width &&
+        decoded->height == canvas_.height && decoded->data.size() == canvas_.data.size();
+    if (skip) {
+        // compressed data is skipped without decoding
+        int code_size;
+        GifByteType* block;
+        if (DGifGetCode(gif_, &code_size, &block) != GIF_OK) {
+            throw std::runtime_error(GifErrorString(gif_->Error));
+        }
+        while (block) {
+            if (DGifGetCodeNext(gif_, &block) != GIF_OK) {
+                throw std::runtime_error(GifErrorString(gif_->Error));
+            }
+        }
+        canvas_.data = decoded->data;
+    }
+
+    line_.resize(frame_w);
+    for (size_t pass = 0; pass < passes && !skip; ++pass) {
+        const size_t first = desc.Interlace ? pass_offset[pass] : 0;
+        const size_t step = desc.Interlace ? pass_step[pass] : 1;
+        for (size_t y = first; y < frame_h; y += step) {
+            if (DGifGetLine(gif_, line_.data(), frame_w) != GIF_OK) {
+                throw std::runtime_error(GifErrorString(gif_->Error));
+            }
+            const size_t canvas_y = frame_y + y;
+            if (canvas_y < canvas_.height) {
+                expand(line_.data(), lut,
+                       &canvas_.data[canvas_y * canvas_.width + frame_x], width);
+            }
+        }
+    }
+
+    disposal_ = gcb.DisposalMode;
+    prev_x_ = frame_x;
+    prev_y_ = frame_y;
+    prev_w_ = width;
+    prev_h_ = std::min(frame_h, canvas_.height - frame_y);
+
+    // use the same delay as browsers do for too fast frames
+    delay = gcb.DelayTime > 1 ? gcb.DelayTime * 10 : default_delay;
+
+    ++frames_;
+    return true;
+}
+
+#endif // HAVE_LIBGIF
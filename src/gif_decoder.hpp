@@ -0,0 +1,114 @@
+// SPDX-License-Identifier: Apache-2.0
+// Copyright (C) 2020 Artem Senichev <artemsen@gmail.com>
+
+#pragma once
+
+#include "image.hpp"
+
+struct GifFileType;
+
+/**
+ * @class gif_decoder
+ * @brief Incremental GIF decoder: frames are decoded one by one and
+ *        composited on the canvas according to their disposal modes.
+ */
+class gif_decoder {
+public:
+    /**
+     * @brief Constructor: open GIF stream and read its header.
+     *
+     * @param[in] data GIF file data, must be valid while the decoder is used
+     * @param[in] size size of the GIF file data
+     *
+     * @throw std::runtime_error on format error
+     */
+    gif_decoder(const uint8_t* data, size_t size);
+
+    ~gif_decoder();
+
+    gif_decoder(const gif_decoder&) = delete;
+    gif_decoder& operator=(const gif_decoder&) = delete;
+
+    /**
+     * @brief Decode the next frame.
+     *
+     * @param[out] delay frame delay in milliseconds
+     * @param[in] decoded the same frame already decoded from the same data
+     *                    (e.g. by the image loader): pixel data of the frame
+     *                    is skipped and the canvas is set to this image
+     *
+     * @throw std::runtime_error on format error
+     *
+     * @return false if there are no more frames
+     */
+    bool next(size_t& delay, const image* decoded = nullptr);
+
+    /**
+     * @brief Restart decoding from the first frame.
+     *
+     * @throw std::runtime_error on format error
+     */
+    void rewind();
+
+    /**
+     * @brief Get canvas with the last decoded frame.
+     *
+     * @return canvas image (size of the logical screen)
+     */
+    const image& canvas() const { return canvas_; }
+
+    /**
+     * @brief Get number of decoded frames since the last rewind.
+     *
+     * @return number of frames
+     */
+    size_t frames() const { return frames_; }
+
+private:
+    /**
+     * @brief Open GIF stream.
+     */
+    void open();
+
+    /**
+     * @brief Close GIF stream.
+     */
+    void close();
+
+    /**
+     * @brief Dispose the previous frame according to its disposal mode.
+     */
+    void dispose();
+
+    /**
+     * @brief Read input data, used as giflib input callback.
+     */
+    static int read(GifFileType* gif, uint8_t* buffer, int size);
+
+private:
+    /** @brief GIF file data. */
+    const uint8_t* data_;
+    /** @brief Size of the GIF file data. */
+    size_t size_;
+    /** @brief Current read position. */
+    size_t pos_ = 0;
+
+    /** @brief giflib decoder instance. */
+    GifFileType* gif_ = nullptr;
+    /** @brief Canvas with the composited frame. */
+    image canvas_;
+    /** @brief Canvas saved before the frame with "restore to previous" disposal. */
+    image::buffer_t saved_;
+    /** @brief Buffer for a row of color indices. */
+    std::vector<uint8_t> line_;
+    /** @brief Number of decoded frames. */
+    size_t frames_ = 0;
+
+    /** @brief Disposal mode of the previous frame. */
+    int disposal_ = 0;
+    /** @brief Area of the previous frame on the canvas. */
+    size_t prev_x_ = 0;
+    size_t prev_y_ = 0;
+    size_t prev_w_ = 0;
+    size_t prev_h_ = 0;
+};
@@ -2,54 +2,91 @@
 // Copyright (C) 2020 Artem Senichev <artemsen@gmail.com>
 
 #include "image.hpp"
+#include "image_scale.hpp"
+#include "thread_pool.hpp"
 
-image image::resize(size_t percent) const
+image image::resize(size_t percent, scale_filter filter,
+                    const grid* bkg /*= nullptr*/) const
 {
-    const float scale = static_cast<float>(percent) / 100.0;
+    const size_t scaled_w = width * percent / 100;
+    const size_t scaled_h = height * percent / 100;
+    return resize(scaled_w, scaled_h, 0, 0, scaled_w, scaled_h, filter, bkg);
+}
+
+image image::resize(size_t scaled_w, size_t scaled_h,
+                    size_t x, size_t y, size_t w, size_t h,
+                    scale_filter filter, const grid* bkg /*= nullptr*/) const
+{
+    if (!transparent) {
+        bkg = nullptr;
+    }
+
+    image img;
+    img.width = w;
+    img.height = h;
+    img.transparent = transparent && !bkg;
+    img.data.resize(img.width * img.height);
+
+    scale_image(*this, img.data.data(), img.width, scaled_w, scaled_h,
+                x, y, w, h, filter, bkg);
+
+    return img;
+}
 
+image image::downsample() const
+{
     image img;
-    img.width = scale * width;
-    img.height = scale * height;
+    img.width = width / 2;
+    img.height = height / 2;
     img.transparent = transparent;
     img.data.resize(img.width * img.height);
 
-    for (size_t y = 0; y < img.height; ++y) {
-        const size_t row_src = static_cast<size_t>(static_cast<float>(y) / scale) * width;
-        const size_t row_dst = y * img.width;
-        for (size_t x = 0; x < img.width; ++x) {
-            img.data[row_dst + x] = data[row_src + static_cast<size_t>(static_cast<float>(x) / scale)];
+    thread_pool::parallel(img.height, [&](size_t begin, size_t end) {
+        for (size_t y = begin; y < end; ++y) {
+            const rgba_t* src0 = &data[y * 2 * width];
+            const rgba_t* src1 = src0 + width;
+            rgba_t* dst = &img.data[y * img.width];
+            for (size_t x = 0; x < img.width; ++x) {
+                const rgba_t a = src0[x * 2];
+                const rgba_t b = src0[x * 2 + 1];
+                const rgba_t c = src1[x * 2];
+                const rgba_t d = src1[x * 2 + 1];
+                // average of 4 pixels, two channels per operation
+                const uint32_t rb = (a & 0x00ff00ff) + (b & 0x00ff00ff) +
+                                    (c & 0x00ff00ff) + (d & 0x00ff00ff) + 0x00020002;
+                const uint32_t ag = ((a >> 8) & 0x00ff00ff) + ((b >> 8) & 0x00ff00ff) +
+                                    ((c >> 8) & 0x00ff00ff) + ((d >> 8) & 0x00ff00ff) +
+                                    0x00020002;
+                dst[x] = ((rb >> 2) & 0x00ff00ff) | ((ag << 6) & 0xff00ff00);
+            }
         }
-    }
+    });
 
     return img;
 }
 
-image image::add_grid(size_t step /*= 10*/, rgba_t clr /*= 0x404040*/) const
+image image::add_grid(size_t step /*= 10*/, rgba_t clr /*= 0x404040*/,
+                      size_t x /*= 0*/, size_t y /*= 0*/) const
 {
     image img = *this;
-    const rgba_t clr2 = clr - 0x00101010;
-
-    for (size_t y = 0; y < img.height; ++y) {
-        for (size_t x = 0; x < img.width; ++x) {
-            rgba_t* pixel = &img.data[x + y * width];
-
-            const uint8_t alpha = *pixel >> 24;
-            if (alpha != 0xff) {
-                const rgba_t bkg = (x / step) % 2 != (y / step) % 2 ? clr : clr2;
-                const rgba_t dst = *pixel;
-                const uint32_t ra = 255 - alpha;
-                // clang-format off
-                *pixel = (((((bkg >> 0)  & 0xff) * ra +
-                            ((dst >> 0)  & 0xff) * alpha) >> 8)) |
-                         (((((bkg >> 8)  & 0xff) * ra +
-                            ((dst >> 8)  & 0xff) * alpha)     )  & ~0xff) |
-                         (((((bkg >> 16) & 0xff) * ra +
-                            ((dst >> 16) & 0xff) * alpha) << 8)  & ~0xffff) |
-                         (((((bkg >> 24) & 0xff) * ra +
-                            ((dst >> 24) & 0xff) * alpha) << 16) & ~0xffffff);
-                // clang-format on
-            }
+    img.transparent = false;
+
+    const grid bkg(step, clr);
+    thread_pool::parallel(img.height, [&](size_t begin, size_t end) {
+        for (size_t dy = begin; dy < end; ++dy) {
+            bkg.blend(&img.data[dy * img.width], x, y + dy, img.width);
         }
-    }
+    });
+
     return img;
 }
+
+bool image::has_transparency() const
+{
+    for (const rgba_t& it : data) {
+        if ((it >> 24) != 0xff) {
+            return true;
+        }
+    }
+    return false;
+}
@@ -3,9 +3,15 @@
 
 #pragma once
 
+#include "image_alloc.hpp"
+
+#include <cstddef>
 #include <cstdint>
 #include <vector>
 
+enum class scale_filter;
+class grid;
+
 /**
  * @class image
  * @brief Image container (RGBA, 32 bits per pixel, 8 bits per color).
@@ -14,32 +20,81 @@ class image
 {
   public:
     using rgba_t = uint32_t;
+    /** @brief Pixel buffer. */
+    using buffer_t = std::vector<rgba_t, image_allocator<rgba_t>>;
 
     /**
      * @brief Resize image.
      *
      * @param[in] percent scale factor
+     * @param[in] filter scale filter to use
+     * @param[in] bkg background for transparent image, nullptr to keep alpha
+     *
+     * @return transformed image instance
+     */
+    image resize(size_t percent, scale_filter filter,
+                 const grid* bkg = nullptr) const;
+
+    /**
+     * @brief Resize image and crop the result.
+     *
+     * @param[in] scaled_w width of the whole scaled image
+     * @param[in] scaled_h height of the whole scaled image
+     * @param[in] x left coordinate of the area to render on the scaled image
+     * @param[in] y top coordinate of the area to render on the scaled image
+     * @param[in] w width of the area to render
+     * @param[in] h height of the area to render
+     * @param[in] filter scale filter to use
+     * @param[in] bkg background for transparent image, nullptr to keep alpha
+     *
+     * @return transformed image instance (area of the scaled image)
+     */
+    image resize(size_t scaled_w, size_t scaled_h,
+                 size_t x, size_t y, size_t w, size_t h,
+                 scale_filter filter, const grid* bkg = nullptr) const;
+
+    /**
+     * @brief Downsample image to the half size with box filter.
      *
      * @return transformed image instance
      */
-    image resize(size_t percent) const;
+    image downsample() const;
 
     /**
      * @brief Add grid as a background for transparent image.
      *
      * @param[in] step grid step (size of a single cell)
      * @param[in] clr grid color
+     * @param[in] x horizontal offset of the grid origin
+     * @param[in] y vertical offset of the grid origin
      *
      * @return transformed image instance
      */
-    image add_grid(size_t step = 10, rgba_t clr = 0x404040) const;
+    image add_grid(size_t step = 10, rgba_t clr = 0x404040,
+                   size_t x = 0, size_t y = 0) const;
 
-    /** @brief Image data array. */
-    std::vector<rgba_t> data;
+    /**
+     * @brief Check if image has at least one non-opaque pixel.
+     *
+     * @return true if image has transparent pixels
+     */
+    bool has_transparency() const;
+
+    /** @brief Image data array, large ones are backed by a temporary file. */
+    buffer_t data;
     /** @brief Width of the image. */
     size_t width = 0;
     /** @brief Height of the image. */
     size_t height = 0;
+    /** @brief Width of the full size image (differs if decoded at reduced size). */
+    size_t full_width = 0;
+    /** @brief Height of the full size image (differs if decoded at reduced size). */
+    size_t full_height = 0;
     /** @brief Flag indicated that the image has valid alpha channel. */
     bool transparent = false;
+    /**
+     * @brief Flag indicated that the image is the first frame of animation,
+     *        the next frames are decoded by the animation player.
+     */
+    bool animated = false;
 };
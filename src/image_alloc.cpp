@@ -0,0 +1,124 @@
+// SPDX-License-Identifier: Apache-2.0
+// Copyright (C) 2020 Artem Senichev <artemsen@gmail.com>
+
+#include "image_alloc.hpp"
+
+#include <atomic>
+#include <cstdlib>
+#include <string>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+/** @brief Min size of the buffer mapped from the temporary file (bytes). */
+constexpr size_t spill_threshold = 256 * 1024 * 1024;
+
+/** @brief Total size of the pixel buffers. */
+static std::atomic<size_t> usage(0);
+/** @brief Memory budget, 0 for unlimited. */
+static std::atomic<size_t> budget(0);
+
+/**
+ * @brief Create unlinked temporary file.
+ *
+ * @param[in] size size of the file
+ *
+ * @return file descriptor, -1 on errors
+ */
+static int spill_file(size_t size)
+{
+    // /tmp is often in RAM, use directory on the disk by default
+    const char* dir = getenv("TMPDIR");
+    if (!dir || !*dir) {
+        dir = "/var/tmp";
+    }
+
+    int fd = -1;
+#ifdef O_TMPFILE
+    fd = open(dir, O_TMPFILE | O_RDWR | O_CLOEXEC, 0600);
+#endif
+    if (fd == -1) {
+        std::string path = dir;
+        path += "/picterm.XXXXXX";
+        fd = mkostemp(&path[0], O_CLOEXEC);
+        if (fd != -1) {
+            unlink(path.c_str());
+        }
+    }
+    if (fd != -1 && ftruncate(fd, size) == -1) {
+        close(fd);
+        fd = -1;
+    }
+    return fd;
+}
+
+void* pixels_alloc(size_t size)
+{
+    if (size < spill_threshold) {
+        void* ptr = malloc(size);
+        if (ptr) {
+            usage += size;
+        }
+        return ptr;
+    }
+
+    void* ptr = MAP_FAILED;
+    const int fd = spill_file(size);
+    if (fd != -1) {
+        ptr = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        close(fd); // mapping keeps the file
+    }
+    if (ptr == MAP_FAILED) {
+        // no space for the file, use anonymous memory
+        ptr = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    }
+    if (ptr == MAP_FAILED) {
+        return nullptr;
+    }
+    usage += size;
+    return ptr;
+}
+
+void pixels_free(void* ptr, size_t size)
+{
+    if (!ptr) {
+        return;
+    }
+    if (size < spill_threshold) {
+        free(ptr);
+    } else {
+        munmap(ptr, size);
+    }
+    usage -= size;
+}
+
+void pixels_account(size_t size, bool alloc)
+{
+    if (alloc) {
+        usage += size;
+    } else {
+        usage -= size;
+    }
+}
+
+size_t pixels_usage()
+{
+    return usage;
+}
+
+void pixels_set_budget(size_t size)
+{
+    budget = size;
+}
+
+size_t pixels_budget()
+{
+    return budget;
+}
+
+bool pixels_fit(size_t size)
+{
+    const size_t limit = budget;
+    return !limit || usage + size <= limit;
+}
@@ -0,0 +1,97 @@
+// SPDX-License-Identifier: Apache-2.0
+// Copyright (C) 2020 Artem Senichev <artemsen@gmail.com>
+
+#pragma once
+
+#include <cstddef>
+#include <new>
+
+/**
+ * @brief Allocate memory for pixels. Large buffers are mapped from an
+ *        unlinked temporary file, so the kernel can write the pages back to
+ *        the disk instead of keeping them in RAM.
+ *
+ * @param[in] size number of bytes to allocate
+ *
+ * @return pointer to the allocated memory, nullptr on errors
+ */
+void* pixels_alloc(size_t size);
+
+/**
+ * @brief Free memory allocated by pixels_alloc().
+ *
+ * @param[in] ptr pointer to the memory
+ * @param[in] size number of bytes passed to pixels_alloc()
+ */
+void pixels_free(void* ptr, size_t size);
+
+/**
+ * @brief Account memory allocated outside of pixels_alloc() (e.g. shared
+ *        memory segments), so it is included in the total usage.
+ *
+ * @param[in] size number of bytes
+ * @param[in] alloc true if memory was allocated, false if freed
+ */
+void pixels_account(size_t size, bool alloc);
+
+/**
+ * @brief Get total size of the pixel buffers.
+ *
+ * @return size in bytes
+ */
+size_t pixels_usage();
+
+/**
+ * @brief Set memory budget for the pixel buffers. The budget is not
+ *        enforced by the allocator, callers check it with pixels_fit()
+ *        before allocating large buffers and degrade gracefully.
+ *
+ * @param[in] size budget in bytes, 0 for unlimited
+ */
+void pixels_set_budget(size_t size);
+
+/**
+ * @brief Get memory budget for the pixel buffers.
+ *
+ * @return budget in bytes, 0 if unlimited
+ */
+size_t pixels_budget();
+
+/**
+ * @brief Check if the new buffer fits the memory budget.
+ *
+ * @param[in] size size of the new buffer in bytes
+ *
+ * @return true if the buffer can be allocated
+ */
+bool pixels_fit(size_t size);
+
+/**
+ * @class image_allocator
+ * @brief Allocator for image pixel buffers (see pixels_alloc()).
+ */
+template <typename T>
+class image_allocator {
+public:
+    using value_type = T;
+
+    image_allocator() = default;
+    template <typename U>
+    image_allocator(const image_allocator<U>&) {}
+
+    T* allocate(size_t n)
+    {
+        void* ptr = pixels_alloc(n * sizeof(T));
+        if (!ptr) {
+            throw std::bad_alloc();
+        }
+        return static_cast<T*>(ptr);
+    }
+
+    void deallocate(T* ptr, size_t n) { pixels_free(ptr, n * sizeof(T)); }
+};
+
+template <typename T, typename U>
+inline bool operator==(const image_allocator<T>&, const image_allocator<U>&) { return true; }
+template <typename T, typename U>
+inline bool operator!=(const image_allocator<T>&, const image_allocator<U>&) { return false; }
@@ -0,0 +1,195 @@
+// SPDX-License-Identifier: Apache-2.0
+// Copyright (C) 2020 Artem Senichev <artemsen@gmail.com>
+
+#include "image_cache.hpp"
+#include "image_ldr.hpp"
+
+#include <exception>
+#include <stdexcept>
+#include <sys/stat.h>
+
+/**
+ * @brief Get size of the image pixel buffer.
+ *
+ * @param[in] img image instance
+ *
+ * @return size in bytes
+ */
+static size_t image_size(const image& img)
+{
+    return img.data.size() * sizeof(image::rgba_t);
+}
+
+bool image_cache::file_stamp::get(const std::string& file)
+{
+    struct stat st;
+    if (stat(file.c_str(), &st) == -1 || !S_ISREG(st.st_mode)) {
+        return false;
+    }
+    sec = st.st_mtim.tv_sec;
+    nsec = st.st_mtim.tv_nsec;
+    size = st.st_size;
+    return true;
+}
+
+image_cache::image_cache(size_t limit)
+    : limit_(limit)
+{
+}
+
+image_cache::~image_cache()
+{
+    if (thread_.joinable()) {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            stop_ = true;
+            queue_.clear();
+        }
+        cond_.notify_all();
+        thread_.join();
+    }
+}
+
+bool image_cache::take(const std::string& file, image& img)
+{
+    std::unique_lock<std::mutex> lock(mutex_);
+
+    cond_.wait(lock, [this, &file]() { return decoding_ != file; });
+
+    auto it = find(file);
+    if (it == entries_.end()) {
+        return false;
+    }
+    size_ -= image_size(it->img);
+    img = std::move(it->img);
+    entries_.erase(it);
+    return true;
+}
+
+void image_cache::put(const std::string& file, image&& img)
+{
+    file_stamp stamp;
+    if (stamp.get(file)) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        insert(file, stamp, std::move(img));
+    }
+}
+
+void image_cache::prefetch(const std::vector<std::string>& files,
+                           size_t fit_w, size_t fit_h)
+{
+    if (!limit_) {
+        return; // cache disabled
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        queue_.clear();
+        for (auto& it : files) {
+            if (it != decoding_ && find(it) == entries_.end()) {
+                queue_.push_back(it);
+            }
+        }
+        fit_w_ = fit_w;
+        fit_h_ = fit_h;
+    }
+
+    if (!thread_.joinable()) {
+        thread_ = std::thread(&image_cache::worker, this);
+    } else {
+        cond_.notify_all();
+    }
+}
+
+void image_cache::worker()
+{
+    std::unique_lock<std::mutex> lock(mutex_);
+
+    while (!stop_) {
+        if (queue_.empty()) {
+            cond_.wait(lock);
+            continue;
+        }
+
+        decoding_ = queue_.front();
+        queue_.erase(queue_.begin());
+        const size_t fit_w = fit_w_;
+        const size_t fit_h = fit_h_;
+        lock.unlock();
+
+        // file state is taken before decoding, so a change made while
+        // decoding is detected on the next lookup
+        file_stamp stamp;
+        image img;
+        bool loaded = false;
+        try {
+            if (!stamp.get(decoding_)) {
+                throw std::runtime_error("Unable to access the file");
+            }
+            load_image(decoding_.c_str(), img, [this](size_t) { return !stop_; },
+                       fit_w, fit_h);
+            if (img.transparent) {
+                img.transparent = img.has_transparency();
+            }
+            loaded = true;
+        } catch (const std::exception&) {
+            // the error will be reported when the image is shown
+        }
+
+        lock.lock();
+        if (loaded) {
+            insert(decoding_, stamp, std::move(img));
+        }
+        decoding_.clear();
+        cond_.notify_all();
+    }
+}
+
+void image_cache::trim(size_t size)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    while (size_ > size && !entries_.empty()) {
+        size_ -= image_size(entries_.back().img);
+        entries_.pop_back();
+    }
+}
+
+std::list<image_cache::entry>::iterator image_cache::find(const std::string& file)
+{
+    for (auto it = entries_.begin(); it != entries_.end(); ++it) {
+        if (it->file == file) {
+            file_stamp stamp;
+            if (stamp.get(file) && stamp == it->stamp) {
+                return it;
+            }
+            // outdated image
+            size_ -= image_size(it->img);
+            entries_.erase(it);
+            break;
+        }
+    }
+    return entries_.end();
+}
+
+void image_cache::insert(const std::string& file, const file_stamp& stamp, image&& img)
+{
+    const size_t size = image_size(img);
+    if (size > limit_) {
+        return; // too big to cache
+    }
+
+    auto it = find(file);
+    if (it != entries_.end()) {
+        size_ -= image_size(it->img);
+        entries_.erase(it);
+    }
+
+    // drop the least recently used images to fit the limit
+    while (size_ + size > limit_ && !entries_.empty()) {
+        size_ -= image_size(entries_.back().img);
+        entries_.pop_back();
+    }
+
+    entries_.push_front(entry { file, stamp, std::move(img) });
+    size_ += size;
+}
@@ -0,0 +1,151 @@
+// SPDX-License-Identifier: Apache-2.0
+// Copyright (C) 2020 Artem Senichev <artemsen@gmail.com>
+
+#pragma once
+
+#include "image.hpp"
+
+#include <atomic>
+#include <condition_variable>
+#include <ctime>
+#include <list>
+#include <mutex>
+#include <string>
+#include <sys/types.h>
+#include <thread>
+#include <vector>
+
+/**
+ * @class image_cache
+ * @brief LRU cache of decoded images with background prefetch.
+ *
+ * Images are moved in and out of the cache, so the cached pixel buffers
+ * are never copied. Total size of the cached images is limited, the least
+ * recently used ones are dropped to fit the limit. Entries are checked
+ * against modification time and size of the file, so changed files are
+ * decoded again.
+ */
+class image_cache {
+public:
+    /**
+     * @brief Constructor.
+     *
+     * @param[in] limit max total size of cached images in bytes, 0 to disable
+     */
+    explicit image_cache(size_t limit);
+
+    ~image_cache();
+
+    /**
+     * @brief Get image from the cache. If the image is being prefetched
+     *        right now, waits for the decoder to finish.
+     *
+     * @param[in] file path to the image file
+     * @param[out] img image to move cached one into
+     *
+     * @return false if image is not in the cache
+     */
+    bool take(const std::string& file, image& img);
+
+    /**
+     * @brief Put image to the cache.
+     *
+     * @param[in] file path to the image file
+     * @param[in] img image to move into the cache
+     */
+    void put(const std::string& file, image&& img);
+
+    /**
+     * @brief Decode images in background, replaces the previous queue.
+     *
+     * @param[in] files list of files to decode, ordered by priority
+     * @param[in] fit_w width of the area to fit the images in, 0 for full size
+     * @param[in] fit_h height of the area to fit the images in, 0 for full size
+     */
+    void prefetch(const std::vector<std::string>& files, size_t fit_w, size_t fit_h);
+
+    /**
+     * @brief Drop the least recently used images to reduce memory usage.
+     *
+     * @param[in] size max total size of the cached images in bytes
+     */
+    void trim(size_t size);
+
+private:
+    /** @brief File state used to detect changes. */
+    struct file_stamp {
+        time_t sec = 0;
+        long nsec = 0;
+        off_t size = -1;
+
+        /**
+         * @brief Get current state of the file.
+         *
+         * @param[in] file path to the file
+         *
+         * @return false if the file can't be accessed
+         */
+        bool get(const std::string& file);
+
+        bool operator==(const file_stamp& other) const
+        {
+            return sec == other.sec && nsec == other.nsec && size == other.size;
+        }
+    };
+
+    /** @brief Cached image. */
+    struct entry {
+        std::string file;
+        file_stamp stamp;
+        image img;
+    };
+
+    /**
+     * @brief Background decoder.
+     */
+    void worker();
+
+    /**
+     * @brief Find cached image, the caller must hold the lock. Entry is
+     *        dropped if the file was changed after decoding.
+     *
+     * @param[in] file path to the image file
+     *
+     * @return iterator of the entry or end() if not found
+     */
+    std::list<entry>::iterator find(const std::string& file);
+
+    /**
+     * @brief Insert image to the cache, the caller must hold the lock.
+     *
+     * @param[in] file path to the image file
+     * @param[in] stamp state of the file the image was decoded from
+     * @param[in] img image to move into the cache
+     */
+    void insert(const std::string& file, const file_stamp& stamp, image&& img);
+
+private:
+    /** @brief Max total size of cached images in bytes. */
+    const size_t limit_;
+    /** @brief Current total size of cached images in bytes. */
+    size_t size_ = 0;
+    /** @brief Cached images, the most recently used first. */
+    std::list<entry> entries_;
+
+    /** @brief Files to prefetch. */
+    std::vector<std::string> queue_;
+    /** @brief File that is being decoded right now. */
+    std::string decoding_;
+    /** @brief Size of the area to fit the prefetched images in. */
+    size_t fit_w_ = 0;
+    size_t fit_h_ = 0;
+
+    /** @brief Background decoder thread. */
+    std::thread thread_;
+    /** @brief Flag used to stop background decoder. */
+    std::atomic<bool> stop_ { false };
+    /** @brief Lock of the cache state. */
+    std::mutex mutex_;
+    /** @brief Condition used to wake up the decoder and its waiters. */
+    std::condition_variable cond_;
+};
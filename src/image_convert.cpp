@@ -0,0 +1,166 @@
+// SPDX-License-Identifier: Apache-2.0
+// Copyright (C) 2020 Artem Senichev <artemsen@gmail.com>
+
+#include "image_convert.hpp"
+#include "cpu.hpp"
+
+#include <cstring>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define CONVERT_X86
+#include <immintrin.h>
+#endif
+
+using rgba_t = image::rgba_t;
+
+/**
+ * @brief Generic kernel for the layout, instantiated at compile time.
+ */
+template <pixel_layout L>
+static void convert_generic(const uint8_t* src, rgba_t* dst, size_t w, const rgba_t* lut)
+{
+    convert_row<L>(src, dst, w, lut);
+}
+
+/**
+ * @brief Kernel for the native layout: pixels are copied as is.
+ */
+static void convert_copy(const uint8_t* src, rgba_t* dst, size_t w, const rgba_t*)
+{
+    memcpy(dst, src, w * sizeof(rgba_t));
+}
+
+#ifdef CONVERT_X86
+__attribute__((target("sse2")))
+static void convert_gray_sse2(const uint8_t* src, rgba_t* dst, size_t w, const rgba_t* lut)
+{
+    const __m128i opaque = _mm_set1_epi8(static_cast<char>(0xff));
+    size_t i = 0;
+    for (; i + 16 <= w; i += 16) {
+        const __m128i g = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i));
+        const __m128i gg = _mm_unpacklo_epi8(g, g);
+        const __m128i ga = _mm_unpacklo_epi8(g, opaque);
+        const __m128i gg_hi = _mm_unpackhi_epi8(g, g);
+        const __m128i ga_hi = _mm_unpackhi_epi8(g, opaque);
+        __m128i* out = reinterpret_cast<__m128i*>(dst + i);
+        _mm_storeu_si128(out + 0, _mm_unpacklo_epi16(gg, ga));
+        _mm_storeu_si128(out + 1, _mm_unpackhi_epi16(gg, ga));
+        _mm_storeu_si128(out + 2, _mm_unpacklo_epi16(gg_hi, ga_hi));
+        _mm_storeu_si128(out + 3, _mm_unpackhi_epi16(gg_hi, ga_hi));
+    }
+    convert_row<pixel_layout::gray>(src + i, dst + i, w - i, lut);
+}
+
+__attribute__((target("ssse3")))
+static void convert_gray_alpha_ssse3(const uint8_t* src, rgba_t* dst, size_t w, const rgba_t* lut)
+{
+    const __m128i lo = _mm_setr_epi8(0, 0, 0, 1, 2, 2, 2, 3, 4, 4, 4, 5, 6, 6, 6, 7);
+    const __m128i hi = _mm_setr_epi8(8, 8, 8, 9, 10, 10, 10, 11, 12, 12, 12, 13, 14, 14, 14, 15);
+    size_t i = 0;
+    for (; i + 8 <= w; i += 8) {
+        const __m128i px = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i * 2));
+        __m128i* out = reinterpret_cast<__m128i*>(dst + i);
+        _mm_storeu_si128(out + 0, _mm_shuffle_epi8(px, lo));
+        _mm_storeu_si128(out + 1, _mm_shuffle_epi8(px, hi));
+    }
+    convert_row<pixel_layout::gray_alpha>(src + i * 2, dst + i, w - i, lut);
+}
+
+__attribute__((target("ssse3")))
+static void convert_rgb_ssse3(const uint8_t* src, rgba_t* dst, size_t w, const rgba_t* lut)
+{
+    const __m128i mask = _mm_setr_epi8(2, 1, 0, -1, 5, 4, 3, -1, 8, 7, 6, -1, 11, 10, 9, -1);
+    const __m128i opaque = _mm_set1_epi32(0xff000000);
+    size_t i = 0;
+    // 16 bytes are loaded for each 4 pixels (12 bytes)
+    for (; i + 6 <= w; i += 4) {
+        const __m128i px = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i * 3));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i),
+                         _mm_or_si128(_mm_shuffle_epi8(px, mask), opaque));
+    }
+    convert_row<pixel_layout::rgb>(src + i * 3, dst + i, w - i, lut);
+}
+
+__attribute__((target("ssse3")))
+static void convert_rgba_ssse3(const uint8_t* src, rgba_t* dst, size_t w, const rgba_t* lut)
+{
+    const __m128i mask = _mm_setr_epi8(2, 1, 0, 3, 6, 5, 4, 7, 10, 9, 8, 11, 14, 13, 12, 15);
+    size_t i = 0;
+    for (; i + 4 <= w; i += 4) {
+        const __m128i px = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i * 4));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i), _mm_shuffle_epi8(px, mask));
+    }
+    convert_row<pixel_layout::rgba>(src + i * 4, dst + i, w - i, lut);
+}
+
+__attribute__((target("avx2")))
+static void convert_palette_avx2(const uint8_t* src, rgba_t* dst, size_t w, const rgba_t* lut)
+{
+    const int* base = reinterpret_cast<const int*>(lut);
+    size_t i = 0;
+    for (; i + 8 <= w; i += 8) {
+        const __m256i idx = _mm256_cvtepu8_epi32(
+            _mm_loadl_epi64(reinterpret_cast<const __m128i*>(src + i)));
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + i),
+                            _mm256_i32gather_epi32(base, idx, sizeof(rgba_t)));
+    }
+    convert_row<pixel_layout::palette>(src + i, dst + i, w - i, lut);
+}
+#endif // CONVERT_X86
+
+convert_fn row_converter(pixel_layout layout)
+{
+#ifdef CONVERT_X86
+    const bool sse2 = cpu_supports(cpu_isa::sse2);
+    const bool ssse3 = cpu_supports(cpu_isa::ssse3);
+    const bool avx2 = cpu_supports(cpu_isa::avx2);
+#endif // CONVERT_X86
+
+    switch (layout) {
+        case pixel_layout::gray:
+#ifdef CONVERT_X86
+            if (sse2) {
+                return convert_gray_sse2;
+            }
+#endif // CONVERT_X86
+            return convert_generic<pixel_layout::gray>;
+        case pixel_layout::gray_alpha:
+#ifdef CONVERT_X86
+            if (ssse3) {
+                return convert_gray_alpha_ssse3;
+            }
+#endif // CONVERT_X86
+            return convert_generic<pixel_layout::gray_alpha>;
+        case pixel_layout::rgb:
+#ifdef CONVERT_X86
+            if (ssse3) {
+                return convert_rgb_ssse3;
+            }
+#endif // CONVERT_X86
+            return convert_generic<pixel_layout::rgb>;
+        case pixel_layout::rgba:
+#ifdef CONVERT_X86
+            if (ssse3) {
+                return convert_rgba_ssse3;
+            }
+#endif // CONVERT_X86
+            return convert_generic<pixel_layout::rgba>;
+        case pixel_layout::bgra:
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+            return convert_copy;
+#else
+            (void)convert_copy;
+            return convert_generic<pixel_layout::bgra>;
+#endif
+        case pixel_layout::cmyk:
+            return convert_generic<pixel_layout::cmyk>;
+        case pixel_layout::palette:
+#ifdef CONVERT_X86
+            if (avx2) {
+                return convert_palette_avx2;
+            }
+#endif // CONVERT_X86
+            return convert_generic<pixel_layout::palette>;
+    }
+    return nullptr;
+}
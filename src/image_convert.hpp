@@ -0,0 +1,135 @@
+// SPDX-License-Identifier: Apache-2.0
+// Copyright (C) 2020 Artem Senichev <artemsen@gmail.com>
+
+#pragma once
+
+#include "image.hpp"
+
+#include <cstddef>
+#include <cstdint>
+
+/** @brief Layout of decoded pixels (8 bits per channel). */
+enum class pixel_layout {
+    gray,       ///< Luminance
+    gray_alpha, ///< Luminance + alpha
+    rgb,        ///< Red, green, blue
+    rgba,       ///< Red, green, blue + alpha
+    bgra,       ///< Blue, green, red + alpha (image::rgba_t in memory)
+    cmyk,       ///< Inverted CMYK (Adobe JPEG)
+    palette     ///< Index in the color table
+};
+
+/**
+ * @struct pixel_traits
+ * @brief Compile-time description of the pixel layout.
+ *
+ * @tparam L pixel layout
+ */
+template <pixel_layout L>
+struct pixel_traits;
+
+template <>
+struct pixel_traits<pixel_layout::gray> {
+    static constexpr size_t size = 1;
+    static image::rgba_t load(const uint8_t* s, const image::rgba_t*)
+    {
+        return 0xff000000 | s[0] * 0x010101;
+    }
+};
+
+template <>
+struct pixel_traits<pixel_layout::gray_alpha> {
+    static constexpr size_t size = 2;
+    static image::rgba_t load(const uint8_t* s, const image::rgba_t*)
+    {
+        return static_cast<image::rgba_t>(s[1]) << 24 | s[0] * 0x010101;
+    }
+};
+
+template <>
+struct pixel_traits<pixel_layout::rgb> {
+    static constexpr size_t size = 3;
+    static image::rgba_t load(const uint8_t* s, const image::rgba_t*)
+    {
+        return 0xff000000 | s[0] << 16 | s[1] << 8 | s[2];
+    }
+};
+
+template <>
+struct pixel_traits<pixel_layout::rgba> {
+    static constexpr size_t size = 4;
+    static image::rgba_t load(const uint8_t* s, const image::rgba_t*)
+    {
+        return static_cast<image::rgba_t>(s[3]) << 24 | s[0] << 16 | s[1] << 8 | s[2];
+    }
+};
+
+template <>
+struct pixel_traits<pixel_layout::bgra> {
+    static constexpr size_t size = 4;
+    static image::rgba_t load(const uint8_t* s, const image::rgba_t*)
+    {
+        return static_cast<image::rgba_t>(s[3]) << 24 | s[2] << 16 | s[1] << 8 | s[0];
+    }
+};
+
+template <>
+struct pixel_traits<pixel_layout::cmyk> {
+    static constexpr size_t size = 4;
+    static image::rgba_t load(const uint8_t* s, const image::rgba_t*)
+    {
+        const uint32_t k = s[3];
+        return 0xff000000 | (s[0] * k + 127) / 255 << 16 |
+            (s[1] * k + 127) / 255 << 8 | (s[2] * k + 127) / 255;
+    }
+};
+
+template <>
+struct pixel_traits<pixel_layout::palette> {
+    static constexpr size_t size = 1;
+    static image::rgba_t load(const uint8_t* s, const image::rgba_t* lut)
+    {
+        return lut[s[0]];
+    }
+};
+
+/**
+ * @brief Convert row of decoded pixels to the image format, the kernel is
+ *        generated for each layout at compile time.
+ *
+ * @tparam L source pixel layout
+ *
+ * @param[in] src decoded pixels
+ * @param[out] dst image pixels, must not overlap the source
+ * @param[in] w number of pixels in the row
+ * @param[in] lut color table (palette layout only)
+ */
+template <pixel_layout L>
+inline void convert_row(const uint8_t* src, image::rgba_t* dst, size_t w,
+                        const image::rgba_t* lut = nullptr)
+{
+    for (size_t i = 0; i < w; ++i) {
+        dst[i] = pixel_traits<L>::load(src, lut);
+        src += pixel_traits<L>::size;
+    }
+}
+
+/**
+ * @brief Row conversion kernel.
+ *
+ * @param[in] src decoded pixels
+ * @param[out] dst image pixels, must not overlap the source
+ * @param[in] w number of pixels in the row
+ * @param[in] lut color table (palette layout only)
+ */
+using convert_fn = void (*)(const uint8_t* src, image::rgba_t* dst, size_t w,
+                            const image::rgba_t* lut);
+
+/**
+ * @brief Get the fastest conversion kernel for the layout supported by CPU.
+ *
+ * @param[in] layout source pixel layout
+ *
+ * @return conversion kernel
+ */
+convert_fn row_converter(pixel_layout layout);
@@ -3,11 +3,17 @@
 
 
 #include "image_ldr.hpp"
+#include "file_data.hpp"
+#include "image_convert.hpp"
+#include "stats.hpp"
+#include "thread_pool.hpp"
 
+#include <algorithm>
 #include <array>
 #include <memory>
 #include <cstring>
-#include <system_error>
+#include <stdexcept>
+#include <string>
 
 /**
  * @struct loader
@@ -29,17 +35,169 @@ struct loader {
     bool (*check)(const file_header_t& header);
 
     /**
-     * @brief Function used for loading image from file.
+     * @brief Function used for loading image from memory.
      *
-     * @param[in] file file to load
+     * @param[in] data image file data
+     * @param[in] size size of the image file data
+     * @param[out] img image to decode into
+     * @param[in] fit_w width of the area to fit the image in, 0 to decode full size
+     * @param[in] fit_h height of the area to fit the image in, 0 to decode full size
+     * @param[in] progress callback for progress notifications
      *
      * @throw std::runtime_error if decoder fails
+     */
+    void (*load)(const uint8_t* data, size_t size, image& img,
+                 size_t fit_w, size_t fit_h, const load_progress_fn& progress);
+
+    /**
+     * @brief Function used for reading image properties from the headers.
      *
-     * @return image instance
+     * @param[in] data image file data
+     * @param[in] size size of the image file data
+     * @param[out] info image properties
+     *
+     * @return false if headers are invalid
      */
-    image (*load)(FILE* fd);
+    bool (*probe)(const uint8_t* data, size_t size, image_info& info);
 };
 
+/**
+ * @struct mem_reader
+ * @brief Sequential reader of the in-memory data, used by decoders
+ *        that read the input via callbacks.
+ */
+struct mem_reader {
+    const uint8_t* data;
+    size_t size;
+    size_t pos;
+
+    /**
+     * @brief Read next block of data.
+     *
+     * @param[out] buffer destination buffer
+     * @param[in] sz number of bytes to read
+     *
+     * @return number of bytes read
+     */
+    size_t read(void* buffer, size_t sz)
+    {
+        sz = std::min(sz, size - pos);
+        memcpy(buffer, data + pos, sz);
+        pos += sz;
+        return sz;
+    }
+};
+
+/** @brief Min number of decoded rows between progress notifications. */
+constexpr size_t progress_rows = 64;
+
+/**
+ * @brief Send progress notification.
+ *
+ * @param[in] progress callback for progress notifications
+ * @param[in] rows number of decoded rows
+ *
+ * @throw std::runtime_error if decoding was aborted
+ */
+static void report(const load_progress_fn& progress, size_t rows)
+{
+    if (progress && !progress(rows)) {
+        throw std::runtime_error("Decoding aborted");
+    }
+}
+
+#if defined(HAVE_LIBJPEG) || defined(HAVE_LIBPNG) || defined(HAVE_LIBWEBP)
+/**
+ * @brief Get reduction factor to decode the image at reduced size: the max
+ *        power of 2 that keeps the image not smaller than the image scaled
+ *        to fit the area.
+ *
+ * @param[in] full_w width of the full size image
+ * @param[in] full_h height of the full size image
+ * @param[in] fit_w width of the area to fit the image in, 0 for full size
+ * @param[in] fit_h height of the area to fit the image in, 0 for full size
+ * @param[in] max max factor supported by the decoder
+ *
+ * @return reduction factor, 1 to decode full size
+ */
+static size_t fit_factor(size_t full_w, size_t full_h, size_t fit_w, size_t fit_h, size_t max)
+{
+    size_t factor = 1;
+    if (fit_w && fit_h && (full_w > fit_w || full_h > fit_h)) {
+        // size of the image scaled to fit the area
+        size_t min_w = fit_w;
+        size_t min_h = fit_h;
+        if (full_w * fit_h > full_h * fit_w) {
+            min_h = full_h * fit_w / full_w;
+        } else {
+            min_w = full_w * fit_h / full_h;
+        }
+        while (factor < max && full_w / (factor * 2) >= min_w &&
+               full_h / (factor * 2) >= min_h) {
+            factor *= 2;
+        }
+    }
+    return factor;
+}
+#endif // HAVE_LIBJPEG || HAVE_LIBPNG || HAVE_LIBWEBP
+
+/**
+ * @brief Read big-endian 32-bit value.
+ *
+ * @param[in] data pointer to the value
+ *
+ * @return value
+ */
+static uint32_t read_be32(const uint8_t* data)
+{
+    return static_cast<uint32_t>(data[0]) << 24 | data[1] << 16 | data[2] << 8 | data[3];
+}
+
+#if defined(HAVE_LIBJPEG) || defined(HAVE_LIBPNG) || defined(HAVE_LIBWEBP)
+/**
+ * @brief Get orientation from EXIF data.
+ *
+ * @param[in] data EXIF data (starts with TIFF header)
+ * @param[in] size size of the EXIF data
+ *
+ * @return EXIF orientation (1-8), 1 if not specified
+ */
+static int exif_orientation(const uint8_t* data, size_t size)
+{
+    if (size < 8 || (memcmp(data, "II", 2) != 0 && memcmp(data, "MM", 2) != 0)) {
+        return 1;
+    }
+    const bool le = data[0] == 'I';
+    auto u16 = [data, le](size_t pos) -> size_t {
+        return le ? data[pos] | data[pos + 1] << 8 : data[pos] << 8 | data[pos + 1];
+    };
+    auto u32 = [&u16, le](size_t pos) -> size_t {
+        return le ? u16(pos) | u16(pos + 2) << 16 : u16(pos) << 16 | u16(pos + 2);
+    };
+
+    if (u16(2) != 42) {
+        return 1;
+    }
+    // search for the orientation tag in IFD0
+    const size_t ifd = u32(4);
+    if (ifd > size - 2) {
+        return 1;
+    }
+    const size_t entries = u16(ifd);
+    for (size_t i = 0; i < entries; ++i) {
+        const size_t pos = ifd + 2 + i * 12;
+        if (pos + 12 > size) {
+            break;
+        }
+        if (u16(pos) == 0x0112) {
+            const size_t val = u16(pos + 8);
+            return val >= 1 && val <= 8 ? static_cast<int>(val) : 1;
+        }
+    }
+    return 1;
+}
+#endif // HAVE_LIBJPEG || HAVE_LIBPNG || HAVE_LIBWEBP
+
 ////////////////////////////////////////////////////////////////////////////////
 // JPEG image support
 ////////////////////////////////////////////////////////////////////////////////
@@ -52,10 +210,55 @@ static bool jpg_check(const loader::file_header_t& header)
     return memcmp(header.data(), sig, sizeof(sig)) == 0;
 }
 
-static image jpg_load(FILE* file)
+/** @brief Minimal number of rows decoded at once. */
+constexpr size_t jpg_block_rows = 16;
+
+static bool jpg_probe(const uint8_t* data, size_t size, image_info& info)
 {
-    image img;
+    // walk through the markers until the start of frame
+    size_t pos = 2;
+    while (pos + 4 <= size) {
+        if (data[pos] != 0xff) {
+            return false;
+        }
+        const uint8_t marker = data[pos + 1];
+        if (marker == 0xff) {
+            ++pos; // fill byte
+            continue;
+        }
+        if (marker == 0x01 || (marker >= 0xd0 && marker <= 0xd8)) {
+            pos += 2; // marker without payload
+            continue;
+        }
+        if (marker == 0xd9 || marker == 0xda) {
+            return false; // end of image or start of scan before frame header
+        }
+        const size_t len = data[pos + 2] << 8 | data[pos + 3];
+        if (len < 2 || pos + 2 + len > size) {
+            return false;
+        }
+        const uint8_t* seg = data + pos + 4;
+        const size_t seg_sz = len - 2;
+        if (marker == 0xe1 && seg_sz > 6 && memcmp(seg, "Exif\0\0", 6) == 0) {
+            info.orientation = exif_orientation(seg + 6, seg_sz - 6);
+        } else if (marker >= 0xc0 && marker <= 0xcf && marker != 0xc4 &&
+                   marker != 0xc8 && marker != 0xcc) {
+            if (seg_sz < 6) {
+                return false;
+            }
+            info.height = seg[1] << 8 | seg[2];
+            info.width = seg[3] << 8 | seg[4];
+            info.alpha = false;
+            return info.width && info.height;
+        }
+        pos += 2 + len;
+    }
+    return false;
+}
 
+static void jpg_load(const uint8_t* data, size_t size, image& img,
+                     size_t fit_w, size_t fit_h, const load_progress_fn& progress)
+{
     std::unique_ptr<jpeg_decompress_struct, void (*)(jpeg_decompress_struct*)> jpg_ptr(
         new jpeg_decompress_struct,
         jpeg_destroy_decompress);
@@ -73,42 +276,92 @@ static image jpg_load(FILE* file)
     };
 
     jpeg_create_decompress(jpg);
-    jpeg_stdio_src(jpg, file);
+    jpeg_mem_src(jpg, const_cast<uint8_t*>(data), size);
     jpeg_read_header(jpg, TRUE);
+
+    // use DCT scaling to decode at reduced size (1/8, 1/4, 1/2)
+    const size_t full_w = jpg->image_width;
+    const size_t full_h = jpg->image_height;
+    jpg->scale_num = 1;
+    jpg->scale_denom = fit_factor(full_w, full_h, fit_w, fit_h, 8);
+
+#ifdef JCS_EXTENSIONS
+    // libjpeg-turbo can output pixels in our native format
+    if (jpg->jpeg_color_space != JCS_CMYK && jpg->jpeg_color_space != JCS_YCCK) {
+        jpg->out_color_space = JCS_EXT_BGRA;
+    }
+#endif // JCS_EXTENSIONS
+
     jpeg_start_decompress(jpg);
 
     img.width = jpg->output_width;
     img.height = jpg->output_height;
+    img.full_width = full_w;
+    img.full_height = full_h;
 
     img.data.resize(img.height * img.width);
-    const size_t row_sz = jpg->num_components * img.width;
-    std::vector<uint8_t> buffer(row_sz);
-    uint8_t* ptr = buffer.data();
-    while (jpg->output_scanline < jpg->output_height) {
-        image::rgba_t* pixel = &img.data[jpg->output_scanline * img.width];
-        jpeg_read_scanlines(jpg, &ptr, 1);
-        for (size_t i = 0; i < row_sz; i += jpg->num_components) {
-            // not the most optimal way, but...
-            switch (jpg->num_components) {
-                case 1:
-                    *pixel = 0xff000000 | buffer[i] << 16 | buffer[i] << 8 | buffer[i];
-                    break;
-                case 3:
-                    *pixel = 0xff000000 | buffer[i] << 16 | buffer[i + 1] << 8 | buffer[i + 2];
-                    break;
-                case 4:
-                    *pixel = buffer[i + 3] << 24 | buffer[i] << 16 | buffer[i + 1] << 8 | buffer[i + 2];
-                    break;
-                default:
-                    throw std::runtime_error(std::to_string(jpg->num_components) + " components not supported yet");
+    report(progress, 0);
+
+    // number of rows decoded by a single call
+    const size_t block = std::max(static_cast<size_t>(jpg->rec_outbuf_height), jpg_block_rows);
+
+#ifdef JCS_EXTENSIONS
+    if (jpg->out_color_space == JCS_EXT_BGRA) {
+        // decode directly into the image buffer
+        std::vector<JSAMPROW> rows(img.height);
+        for (size_t y = 0; y < img.height; ++y) {
+            rows[y] = reinterpret_cast<JSAMPROW>(&img.data[y * img.width]);
+        }
+        size_t reported = 0;
+        while (jpg->output_scanline < jpg->output_height) {
+            const size_t count = std::min(block, img.height - jpg->output_scanline);
+            jpeg_read_scanlines(jpg, &rows[jpg->output_scanline], count);
+            if (jpg->output_scanline - reported >= progress_rows) {
+                reported = jpg->output_scanline;
+                report(progress, reported);
             }
-            ++pixel;
         }
+        jpeg_finish_decompress(jpg);
+        return;
     }
+#endif // JCS_EXTENSIONS
 
-    jpeg_finish_decompress(jpg);
+    pixel_layout layout;
+    switch (jpg->output_components) {
+        case 1:
+            layout = pixel_layout::gray;
+            break;
+        case 3:
+            layout = pixel_layout::rgb;
+            break;
+        case 4:
+            layout = pixel_layout::cmyk;
+            break;
+        default:
+            throw std::runtime_error(std::to_string(jpg->output_components) + " components not supported yet");
+    }
+    const convert_fn convert = row_converter(layout);
 
-    return img;
+    const size_t row_sz = jpg->output_components * img.width;
+    std::vector<uint8_t> buffer(row_sz * block);
+    std::vector<JSAMPROW> rows(block);
+    for (size_t i = 0; i < block; ++i) {
+        rows[i] = &buffer[i * row_sz];
+    }
+    size_t reported = 0;
+    while (jpg->output_scanline < jpg->output_height) {
+        const size_t first = jpg->output_scanline;
+        const size_t count = jpeg_read_scanlines(jpg, rows.data(), block);
+        for (size_t i = 0; i < count; ++i) {
+            convert(rows[i], &img.data[(first + i) * img.width], img.width, nullptr);
+        }
+        if (jpg->output_scanline - reported >= progress_rows) {
+            reported = jpg->output_scanline;
+            report(progress, reported);
+        }
+    }
+
+    jpeg_finish_decompress(jpg);
 }
 #endif // HAVE_LIBJPEG
 
@@ -124,9 +377,137 @@ static bool png_check(const loader::file_header_t& header)
     return memcmp(header.data(), sig, sizeof(sig)) == 0;
 }
 
-static image png_load(FILE* file)
+/** @brief Max reduction factor of PNG image decoded at reduced size. */
+constexpr size_t png_max_factor = 256;
+/** @brief Max number of colors in PNG palette. */
+constexpr size_t png_palette_size = 256;
+
+static bool png_probe(const uint8_t* data, size_t size, image_info& info)
 {
-    image img;
+    // signature followed by IHDR chunk
+    if (size < 33 || memcmp(data + 12, "IHDR", 4) != 0) {
+        return false;
+    }
+    info.width = read_be32(data + 16);
+    info.height = read_be32(data + 20);
+    const uint8_t color_type = data[25];
+    info.alpha = color_type == PNG_COLOR_TYPE_GRAY_ALPHA || color_type == PNG_COLOR_TYPE_RGB_ALPHA;
+
+    // ancillary chunks before the image data
+    size_t pos = 33;
+    while (pos + 8 <= size) {
+        const size_t len = read_be32(data + pos);
+        const uint8_t* type = data + pos + 4;
+        if (memcmp(type, "IDAT", 4) == 0 || len > size - pos - 8) {
+            break;
+        }
+        if (memcmp(type, "tRNS", 4) == 0) {
+            info.alpha = true;
+        } else if (memcmp(type, "eXIf", 4) == 0) {
+            info.orientation = exif_orientation(data + pos + 8, len);
+        }
+        pos += len + 12; // length, type, data and CRC
+    }
+    return info.width && info.height;
+}
+
+/**
+ * @brief Get color table of the palette image, transparency is applied to
+ *        the colors.
+ *
+ * @param[in] png libpng read object
+ * @param[in] info libpng info object
+ * @param[out] lut color table with png_palette_size entries
+ */
+static void png_palette(png_structp png, png_infop info, image::rgba_t* lut)
+{
+    static_assert(sizeof(png_color) == 3, "Unexpected png_color layout");
+
+    std::fill(lut, lut + png_palette_size, 0xff000000);
+
+    png_colorp colors;
+    int num_colors = 0;
+    if (png_get_PLTE(png, info, &colors, &num_colors) == PNG_INFO_PLTE) {
+        const size_t num = std::min(static_cast<size_t>(num_colors), png_palette_size);
+        convert_row<pixel_layout::rgb>(reinterpret_cast<const uint8_t*>(colors), lut, num);
+    }
+
+    png_bytep trans;
+    int num_trans = 0;
+    if (png_get_tRNS(png, info, &trans, &num_trans, nullptr) == PNG_INFO_tRNS) {
+        const size_t num = std::min(static_cast<size_t>(num_trans), png_palette_size);
+        for (size_t i = 0; i < num; ++i) {
+            lut[i] = (lut[i] & 0x00ffffff) | static_cast<image::rgba_t>(trans[i]) << 24;
+        }
+    }
+}
+
+/**
+ * @brief Decode image at reduced size row by row: each block of factor x
+ *        factor pixels is averaged into a single pixel as soon as its rows
+ *        are read, so the full size image is never kept in memory.
+ *
+ * @param[in] png libpng read object
+ * @param[in] full_w width of the full size image
+ * @param[in] full_h height of the full size image
+ * @param[in] factor reduction factor
+ * @param[in] row_sz size of the decoded row in bytes
+ * @param[in] convert row conversion kernel
+ * @param[in] lut color table for the palette layout
+ * @param[in,out] img image to decode into (size is already set)
+ * @param[in] progress callback for progress notifications
+ */
+static void png_read_reduced(png_structp png, size_t full_w, size_t full_h, size_t factor,
+                             size_t row_sz, convert_fn convert, const image::rgba_t* lut,
+                             image& img, const load_progress_fn& progress)
+{
+    std::vector<uint8_t> raw(row_sz);
+    std::vector<image::rgba_t> row(full_w);
+    std::vector<uint32_t> acc(img.width * 4, 0);
+
+    for (size_t y = 0; y < full_h; ++y) {
+        png_read_row(png, raw.data(), nullptr);
+        convert(raw.data(), row.data(), full_w, lut);
+
+        // sum of channels for each destination column
+        uint32_t* sum = acc.data();
+        for (size_t x = 0; x < full_w; x += factor) {
+            const size_t end = std::min(x + factor, full_w);
+            for (size_t i = x; i < end; ++i) {
+                const image::rgba_t px = row[i];
+                sum[0] += px & 0xff;
+                sum[1] += (px >> 8) & 0xff;
+                sum[2] += (px >> 16) & 0xff;
+                sum[3] += px >> 24;
+            }
+            sum += 4;
+        }
+
+        const size_t rows = y % factor + 1;
+        if (rows != factor && y != full_h - 1) {
+            continue;
+        }
+
+        // block of rows is complete, put the averaged row
+        const size_t dst_y = y / factor;
+        image::rgba_t* dst = &img.data[dst_y * img.width];
+        for (size_t x = 0; x < img.width; ++x) {
+            const uint32_t n = rows * std::min(factor, full_w - x * factor);
+            uint32_t* ch = &acc[x * 4];
+            dst[x] = ((ch[0] + n / 2) / n) | ((ch[1] + n / 2) / n) << 8 |
+                ((ch[2] + n / 2) / n) << 16 | ((ch[3] + n / 2) / n) << 24;
+        }
+        std::fill(acc.begin(), acc.end(), 0);
+        if (dst_y && dst_y % progress_rows == 0) {
+            report(progress, dst_y);
+        }
+    }
+}
+
+static void png_load(const uint8_t* data, size_t size, image& img,
+                     size_t fit_w, size_t fit_h, const load_progress_fn& progress)
+{
+    mem_reader reader { data, size, 0 };
     png_structp png = nullptr;
     png_infop info = nullptr;
 
@@ -146,9 +527,13 @@ static image png_load(FILE* file)
             throw std::runtime_error("Unable to create libpng info object");
         }
 
-        png_init_io(png, file);
+        png_set_read_fn(png, &reader, [](png_structp png, png_bytep buffer, png_size_t sz) {
+            mem_reader* reader = static_cast<mem_reader*>(png_get_io_ptr(png));
+            if (reader->read(buffer, sz) != sz) {
+                png_error(png, "Unexpected end of file");
+            }
+        });
         png_read_info(png, info);
-        png_set_bgr(png);
 
         img.width = png_get_image_width(png, info);
         img.height = png_get_image_height(png, info);
@@ -156,39 +541,110 @@ static image png_load(FILE* file)
         const png_byte color_type = png_get_color_type(png, info);
         const png_byte bit_depth = png_get_bit_depth(png, info);
 
-        // Read any color_type into 8bit depth, RGBA format.
+        // read any color type with 8 bits per channel, channels are
+        // reordered by the converter
         if (bit_depth == 16) {
             png_set_strip_16(png);
         }
-        if (color_type == PNG_COLOR_TYPE_PALETTE) {
-            png_set_palette_to_rgb(png);
-        }
-        // PNG_COLOR_TYPE_GRAY_ALPHA is always 8 or 16bit depth.
-        if (color_type == PNG_COLOR_TYPE_GRAY && bit_depth < 8) {
-            png_set_expand_gray_1_2_4_to_8(png);
-        }
-        if (png_get_valid(png, info, PNG_INFO_tRNS)) {
-            png_set_tRNS_to_alpha(png);
-        }
-        // These color_type don't have an alpha channel then fill it with 0xff.
-        img.transparent = !(color_type == PNG_COLOR_TYPE_RGB ||
-                            color_type == PNG_COLOR_TYPE_GRAY ||
-                            color_type == PNG_COLOR_TYPE_PALETTE);
-        if (!img.transparent) {
-            png_set_filler(png, 0xff, PNG_FILLER_AFTER);
+        if (bit_depth < 8) {
+            if (color_type == PNG_COLOR_TYPE_GRAY) {
+                png_set_expand_gray_1_2_4_to_8(png);
+            } else {
+                png_set_packing(png); // single palette index per byte
+            }
         }
-        if (color_type == PNG_COLOR_TYPE_GRAY || color_type == PNG_COLOR_TYPE_GRAY_ALPHA) {
-            png_set_gray_to_rgb(png);
+
+        const bool trns = png_get_valid(png, info, PNG_INFO_tRNS);
+        image::rgba_t lut[png_palette_size];
+        pixel_layout layout;
+        switch (color_type) {
+            case PNG_COLOR_TYPE_PALETTE:
+                layout = pixel_layout::palette;
+                png_palette(png, info, lut);
+                img.transparent = trns;
+                break;
+            case PNG_COLOR_TYPE_GRAY:
+                if (trns) {
+                    png_set_tRNS_to_alpha(png);
+                }
+                layout = trns ? pixel_layout::gray_alpha : pixel_layout::gray;
+                img.transparent = trns;
+                break;
+            case PNG_COLOR_TYPE_GRAY_ALPHA:
+                layout = pixel_layout::gray_alpha;
+                img.transparent = true;
+                break;
+            case PNG_COLOR_TYPE_RGB:
+                if (trns) {
+                    png_set_tRNS_to_alpha(png);
+                }
+                layout = trns ? pixel_layout::rgba : pixel_layout::rgb;
+                img.transparent = trns;
+                break;
+            default:
+                layout = pixel_layout::rgba;
+                img.transparent = true;
+                break;
         }
+        const convert_fn convert = row_converter(layout);
 
+        const int passes = png_set_interlace_handling(png);
         png_read_update_info(png, info);
+        const size_t row_sz = png_get_rowbytes(png, info);
+
+        img.full_width = img.width;
+        img.full_height = img.height;
+
+        // interlaced image can't be reduced on the fly: rows are complete
+        // only after the last pass
+        const size_t factor = passes == 1 ?
+            fit_factor(img.width, img.height, fit_w, fit_h, png_max_factor) : 1;
+        if (factor > 1) {
+            img.width = (img.full_width + factor - 1) / factor;
+            img.height = (img.full_height + factor - 1) / factor;
+            img.data.resize(img.height * img.width);
+            report(progress, 0);
+            png_read_reduced(png, img.full_width, img.full_height, factor,
+                             row_sz, convert, lut, img, progress);
+            png_destroy_read_struct(&png, &info, nullptr);
+            return;
+        }
 
         img.data.resize(img.height * img.width);
-        std::vector<png_bytep> rows(img.height);
-        for (size_t y = 0; y < img.height; ++y) {
-            rows[y] = reinterpret_cast<png_bytep>(&img.data[y * img.width]);
+        report(progress, 0);
+
+        if (passes == 1) {
+            std::vector<uint8_t> raw(row_sz);
+            for (size_t y = 0; y < img.height; ++y) {
+                png_read_row(png, raw.data(), nullptr);
+                convert(raw.data(), &img.data[y * img.width], img.width, lut);
+                if (y && y % progress_rows == 0) {
+                    report(progress, y);
+                }
+            }
+        } else {
+            // passes are combined in place in the image rows (decoded pixel
+            // is never larger than image::rgba_t), each row is converted as
+            // soon as the last pass completes it
+            std::vector<uint8_t> raw(row_sz);
+            for (int pass = 0; pass < passes; ++pass) {
+                const bool last = pass == passes - 1;
+                for (size_t y = 0; y < img.height; ++y) {
+                    image::rgba_t* dst = &img.data[y * img.width];
+                    png_read_row(png, reinterpret_cast<png_bytep>(dst), nullptr);
+                    if (last) {
+                        memcpy(raw.data(), dst, row_sz);
+                        convert(raw.data(), dst, img.width, lut);
+                        if (y && y % progress_rows == 0) {
+                            report(progress, y);
+                        }
+                    }
+                }
+                if (!last) {
+                    report(progress, 0); // check for abort
+                }
+            }
         }
-        png_read_image(png, rows.data());
 
         png_destroy_read_struct(&png, &info, nullptr);
 
@@ -198,8 +654,6 @@ static image png_load(FILE* file)
         }
         throw;
     }
-
-    return img;
 }
 #endif // HAVE_LIBPNG
 
@@ -207,7 +661,7 @@ static image png_load(FILE* file)
 // GIF image support
 ////////////////////////////////////////////////////////////////////////////////
 #ifdef HAVE_LIBGIF
-#include <gif_lib.h>
+#include "gif_decoder.hpp"
 
 static bool gif_check(const loader::file_header_t& header)
 {
@@ -215,111 +669,532 @@ static bool gif_check(const loader::file_header_t& header)
     return memcmp(header.data(), sig, sizeof(sig)) == 0;
 }
 
-static int gif_reader(GifFileType* gft, GifByteType* buffer, int sz)
+static bool gif_probe(const uint8_t* data, size_t size, image_info& info)
 {
-    return fread(buffer, 1, sz, reinterpret_cast<FILE*>(gft->UserData));
+    // logical screen descriptor
+    if (size < 13) {
+        return false;
+    }
+    info.width = data[6] | data[7] << 8;
+    info.height = data[8] | data[9] << 8;
+    info.alpha = false;
+
+    // look for transparent color in extensions before the first frame
+    size_t pos = 13;
+    if (data[10] & 0x80) {
+        pos += 3 << ((data[10] & 0x07) + 1); // global color table
+    }
+    while (pos + 2 <= size && data[pos] == 0x21) {
+        if (data[pos + 1] == 0xf9 && pos + 4 <= size && data[pos + 2] >= 4) {
+            info.alpha = data[pos + 3] & 0x01; // graphic control extension
+        }
+        // skip sub-blocks
+        pos += 2;
+        while (pos < size && data[pos]) {
+            pos += data[pos] + 1;
+        }
+        ++pos;
+    }
+    return info.width && info.height;
 }
 
-static image gif_load(FILE* file)
+static void gif_load(const uint8_t* data, size_t size, image& img,
+                     size_t, size_t, const load_progress_fn& progress)
 {
-    image img;
+    // decode the first frame only, animation is played by the viewer
+    gif_decoder gif(data, size);
+    size_t delay;
+    if (!gif.next(delay)) {
+        throw std::runtime_error("No frames in GIF");
+    }
+
+    img = gif.canvas();
+    img.animated = true;
+    report(progress, 0);
+}
+#endif // HAVE_LIBGIF
+
+////////////////////////////////////////////////////////////////////////////////
+// WebP image support
+////////////////////////////////////////////////////////////////////////////////
+#ifdef HAVE_LIBWEBP
+#include <webp/decode.h>
+
+static bool webp_check(const loader::file_header_t& header)
+{
+    return memcmp(header.data(), "RIFF", 4) == 0 && memcmp(header.data() + 8, "WEBP", 4) == 0;
+}
+
+static bool webp_probe(const uint8_t* data, size_t size, image_info& info)
+{
+    WebPBitstreamFeatures features;
+    if (WebPGetFeatures(data, size, &features) != VP8_STATUS_OK) {
+        return false;
+    }
+    info.width = features.width;
+    info.height = features.height;
+    info.alpha = features.has_alpha;
+
+    // EXIF chunk of the extended format
+    size_t pos = 12;
+    while (pos + 8 <= size) {
+        const size_t len = data[pos + 4] | data[pos + 5] << 8 | data[pos + 6] << 16 |
+            static_cast<size_t>(data[pos + 7]) << 24;
+        if (len > size - pos - 8) {
+            break;
+        }
+        if (memcmp(data + pos, "EXIF", 4) == 0) {
+            const uint8_t* exif = data + pos + 8;
+            size_t exif_sz = len;
+            if (exif_sz > 6 && memcmp(exif, "Exif\0\0", 6) == 0) {
+                exif += 6;
+                exif_sz -= 6;
+            }
+            info.orientation = exif_orientation(exif, exif_sz);
+            break;
+        }
+        pos += 8 + len + (len & 1); // chunks are padded to even size
+    }
+    return true;
+}
+
+/** @brief Max reduction factor of WebP image decoded at reduced size. */
+constexpr size_t webp_max_factor = 256;
+
+static void webp_load(const uint8_t* data, size_t size, image& img,
+                      size_t fit_w, size_t fit_h, const load_progress_fn& progress)
+{
+    WebPDecoderConfig config;
+    if (!WebPInitDecoderConfig(&config)) {
+        throw std::runtime_error("Incompatible libwebp version");
+    }
+    if (WebPGetFeatures(data, size, &config.input) != VP8_STATUS_OK) {
+        throw std::runtime_error("Invalid WebP header");
+    }
+    if (config.input.has_animation) {
+        throw std::runtime_error("Animated WebP not supported yet");
+    }
+
+    img.full_width = config.input.width;
+    img.full_height = config.input.height;
+    img.transparent = config.input.has_alpha;
+
+    // the decoder can scale the image while decoding
+    const size_t factor = fit_factor(img.full_width, img.full_height, fit_w, fit_h,
+                                     webp_max_factor);
+    img.width = (img.full_width + factor - 1) / factor;
+    img.height = (img.full_height + factor - 1) / factor;
+    if (factor > 1) {
+        config.options.use_scaling = 1;
+        config.options.scaled_width = static_cast<int>(img.width);
+        config.options.scaled_height = static_cast<int>(img.height);
+    }
+    config.options.use_threads = thread_pool::threads() > 1;
+
+    img.data.resize(img.height * img.width);
+    report(progress, 0);
+
+    // decode directly into the image buffer
+    config.output.colorspace = MODE_BGRA;
+    config.output.is_external_memory = 1;
+    config.output.u.RGBA.rgba = reinterpret_cast<uint8_t*>(img.data.data());
+    config.output.u.RGBA.stride = static_cast<int>(img.width * sizeof(image::rgba_t));
+    config.output.u.RGBA.size = img.data.size() * sizeof(image::rgba_t);
 
-    int err = 0;
-    std::unique_ptr<GifFileType, void(*)(GifFileType*)> gif_ptr(
-        DGifOpen(file, gif_reader, &err),
-        [](GifFileType* gif){ DGifCloseFile(gif, nullptr); });
-    if (!gif_ptr.get()) {
-        throw std::runtime_error(GifErrorString(err));
+    const VP8StatusCode rc = WebPDecode(data, size, &config);
+    WebPFreeDecBuffer(&config.output);
+    if (rc != VP8_STATUS_OK) {
+        throw std::runtime_error("WebP decoding failed, code " + std::to_string(rc));
     }
-    GifFileType* gif = gif_ptr.get();
+}
+#endif // HAVE_LIBWEBP
 
-    // decode with high-level API
-    if (DGifSlurp(gif) != GIF_OK) {
-        throw std::runtime_error(GifErrorString(gif->Error));
+////////////////////////////////////////////////////////////////////////////////
+// AVIF image support
+////////////////////////////////////////////////////////////////////////////////
+#ifdef HAVE_LIBAVIF
+#include <avif/avif.h>
+
+static bool avif_check(const loader::file_header_t& header)
+{
+    return memcmp(header.data() + 4, "ftypavif", 8) == 0 ||
+        memcmp(header.data() + 4, "ftypavis", 8) == 0;
+}
+
+static bool avif_probe(const uint8_t* data, size_t size, image_info& info)
+{
+    std::unique_ptr<avifDecoder, void (*)(avifDecoder*)> decoder(avifDecoderCreate(),
+                                                                 avifDecoderDestroy);
+    // parse containers only, no pixels decoded
+    if (!decoder || avifDecoderSetIOMemory(decoder.get(), data, size) != AVIF_RESULT_OK ||
+        avifDecoderParse(decoder.get()) != AVIF_RESULT_OK) {
+        return false;
     }
-    if (!gif->SavedImages) {
-        throw std::runtime_error("Something wrong with giflib");
+    info.width = decoder->image->width;
+    info.height = decoder->image->height;
+    info.alpha = decoder->alphaPresent;
+    return true;
+}
+
+static void avif_load(const uint8_t* data, size_t size, image& img,
+                      size_t, size_t, const load_progress_fn& progress)
+{
+    std::unique_ptr<avifDecoder, void (*)(avifDecoder*)> decoder(avifDecoderCreate(),
+                                                                 avifDecoderDestroy);
+    if (!decoder) {
+        throw std::runtime_error("Unable to create AVIF decoder");
+    }
+    decoder->maxThreads = static_cast<int>(thread_pool::threads());
+
+    avifResult rc = avifDecoderSetIOMemory(decoder.get(), data, size);
+    if (rc == AVIF_RESULT_OK) {
+        rc = avifDecoderParse(decoder.get());
+    }
+    if (rc == AVIF_RESULT_OK) {
+        rc = avifDecoderNextImage(decoder.get());
+    }
+    if (rc != AVIF_RESULT_OK) {
+        throw std::runtime_error(avifResultToString(rc));
     }
 
-    img.width = gif->SWidth;
-    img.height = gif->SHeight;
-    img.transparent = true;
+    const avifImage* avif = decoder->image;
+    img.width = img.full_width = avif->width;
+    img.height = img.full_height = avif->height;
+    img.transparent = avif->alphaPlane != nullptr;
     img.data.resize(img.height * img.width);
+    report(progress, 0);
+
+    // convert YUV directly into the image buffer
+    avifRGBImage rgb;
+    avifRGBImageSetDefaults(&rgb, avif);
+    rgb.format = AVIF_RGB_FORMAT_BGRA;
+    rgb.depth = 8;
+    rgb.pixels = reinterpret_cast<uint8_t*>(img.data.data());
+    rgb.rowBytes = static_cast<uint32_t>(img.width * sizeof(image::rgba_t));
+#if AVIF_VERSION >= 1000000
+    rgb.maxThreads = static_cast<int>(thread_pool::threads());
+#endif
+    rc = avifImageYUVToRGB(avif, &rgb);
+    if (rc != AVIF_RESULT_OK) {
+        throw std::runtime_error(avifResultToString(rc));
+    }
+}
+#endif // HAVE_LIBAVIF
 
-    // We don't support animation, will show the first frame only
-    const GifImageDesc& frame_desc = gif->SavedImages->ImageDesc;
-    const int frame_x = frame_desc.Left;
-    const int frame_y = frame_desc.Top;
-    const int frame_w = frame_desc.Width;
-    const int frame_h = frame_desc.Height;
-    const GifColorType* clr_map = gif->SColorMap ? gif->SColorMap->Colors : frame_desc.ColorMap->Colors;
-
-    for (int y = 0; y < frame_h; ++y) {
-        image::rgba_t* pixel = &img.data[frame_y * img.width + y * img.width + frame_x]; 
-        const uint8_t* raster = &gif->SavedImages->RasterBits[y * img.width];
-        for (int x = 0; x < frame_w; ++x) {
-            const uint8_t& color = raster[x];
-            if (color != gif->SBackGroundColor) {
-                const GifColorType& rgb = clr_map[color];
-                *pixel = 0xff000000 | rgb.Red << 16 | rgb.Green << 8 | rgb.Blue;
+////////////////////////////////////////////////////////////////////////////////
+// HEIF image support
+////////////////////////////////////////////////////////////////////////////////
+#ifdef HAVE_LIBHEIF
+#include <libheif/heif.h>
+
+static bool heif_check(const loader::file_header_t& header)
+{
+    static const char* brands[] = {
+        "heic", "heix", "hevc", "hevx", "heim", "heis", "mif1", "msf1",
+#ifndef HAVE_LIBAVIF
+        "avif", "avis", // libheif decodes AV1 images too
+#endif
+    };
+    if (memcmp(header.data() + 4, "ftyp", 4) == 0) {
+        for (const char* brand : brands) {
+            if (memcmp(header.data() + 8, brand, 4) == 0) {
+                return true;
             }
-            ++pixel;
         }
     }
+    return false;
+}
 
-    return img;
+/**
+ * @brief Throw exception if libheif call failed.
+ *
+ * @param[in] err result of the libheif call
+ */
+static void heif_throw(const heif_error& err)
+{
+    if (err.code != heif_error_Ok) {
+        throw std::runtime_error(err.message ? err.message : "HEIF decoding failed");
+    }
+}
+
+static bool heif_probe(const uint8_t* data, size_t size, image_info& info)
+{
+    std::unique_ptr<heif_context, void (*)(heif_context*)> ctx(heif_context_alloc(),
+                                                               heif_context_free);
+    heif_image_handle* handle = nullptr;
+    if (!ctx ||
+        heif_context_read_from_memory_without_copy(ctx.get(), data, size, nullptr).code != heif_error_Ok ||
+        heif_context_get_primary_image_handle(ctx.get(), &handle).code != heif_error_Ok) {
+        return false;
+    }
+    // image transformations (rotation, mirroring) are applied by libheif,
+    // so the size is given as displayed
+    info.width = heif_image_handle_get_width(handle);
+    info.height = heif_image_handle_get_height(handle);
+    info.alpha = heif_image_handle_has_alpha_channel(handle);
+    heif_image_handle_release(handle);
+    return true;
+}
+
+static void heif_load(const uint8_t* data, size_t size, image& img,
+                      size_t, size_t, const load_progress_fn& progress)
+{
+    std::unique_ptr<heif_context, void (*)(heif_context*)> ctx(heif_context_alloc(),
+                                                               heif_context_free);
+    if (!ctx) {
+        throw std::runtime_error("Unable to create HEIF context");
+    }
+#if LIBHEIF_NUMERIC_VERSION >= 0x010d0000
+    heif_context_set_max_decoding_threads(ctx.get(), static_cast<int>(thread_pool::threads()));
+#endif
+    heif_throw(heif_context_read_from_memory_without_copy(ctx.get(), data, size, nullptr));
+
+    heif_image_handle* handle_ptr = nullptr;
+    heif_throw(heif_context_get_primary_image_handle(ctx.get(), &handle_ptr));
+    std::unique_ptr<heif_image_handle, void (*)(const heif_image_handle*)> handle(
+        handle_ptr, heif_image_handle_release);
+
+    img.transparent = heif_image_handle_has_alpha_channel(handle.get());
+
+    heif_image* himg_ptr = nullptr;
+    heif_throw(heif_decode_image(handle.get(), &himg_ptr, heif_colorspace_RGB,
+                                 img.transparent ? heif_chroma_interleaved_RGBA :
+                                                   heif_chroma_interleaved_RGB,
+                                 nullptr));
+    std::unique_ptr<heif_image, void (*)(const heif_image*)> himg(himg_ptr, heif_image_release);
+
+    int stride = 0;
+    const uint8_t* pixels = heif_image_get_plane_readonly(himg.get(), heif_channel_interleaved,
+                                                          &stride);
+    if (!pixels) {
+        throw std::runtime_error("No pixels in HEIF image");
+    }
+
+    img.width = img.full_width = heif_image_get_width(himg.get(), heif_channel_interleaved);
+    img.height = img.full_height = heif_image_get_height(himg.get(), heif_channel_interleaved);
+    img.data.resize(img.height * img.width);
+    report(progress, 0);
+
+    const convert_fn convert = row_converter(img.transparent ? pixel_layout::rgba :
+                                                               pixel_layout::rgb);
+    for (size_t y = 0; y < img.height; ++y) {
+        convert(pixels + y * stride, &img.data[y * img.width], img.width, nullptr);
+        if (y && y % progress_rows == 0) {
+            report(progress, y);
+        }
+    }
+}
+#endif // HAVE_LIBHEIF
+
+////////////////////////////////////////////////////////////////////////////////
+// QOI image support (built-in decoder)
+////////////////////////////////////////////////////////////////////////////////
+static bool qoi_check(const loader::file_header_t& header)
+{
+    return memcmp(header.data(), "qoif", 4) == 0;
+}
+
+/** @brief Size of the QOI header. */
+constexpr size_t qoi_header_size = 14;
+/** @brief Max number of pixels in QOI image (limit of the specification). */
+constexpr size_t qoi_max_pixels = 400000000;
+
+static bool qoi_probe(const uint8_t* data, size_t size, image_info& info)
+{
+    if (size < qoi_header_size) {
+        return false;
+    }
+    info.width = read_be32(data + 4);
+    info.height = read_be32(data + 8);
+    info.alpha = data[12] == 4;
+    return info.width && info.height;
+}
+
+static void qoi_load(const uint8_t* data, size_t size, image& img,
+                     size_t, size_t, const load_progress_fn& progress)
+{
+    if (size < qoi_header_size) {
+        throw std::runtime_error("Invalid QOI header");
+    }
+    const size_t width = read_be32(data + 4);
+    const size_t height = read_be32(data + 8);
+    const uint8_t channels = data[12];
+    if (!width || !height || width * height > qoi_max_pixels ||
+        (channels != 3 && channels != 4)) {
+        throw std::runtime_error("Invalid QOI header");
+    }
+
+    img.width = img.full_width = width;
+    img.height = img.full_height = height;
+    img.transparent = channels == 4;
+    img.data.resize(img.height * img.width);
+    report(progress, 0);
+
+    uint8_t index[64][4] = {};
+    uint8_t px[4] = { 0, 0, 0, 0xff }; // r, g, b, a
+    size_t run = 0;
+    size_t pos = qoi_header_size;
+
+    for (size_t y = 0; y < height; ++y) {
+        image::rgba_t* dst = &img.data[y * width];
+        for (size_t x = 0; x < width; ++x) {
+            if (run) {
+                --run;
+            } else {
+                if (pos >= size) {
+                    throw std::runtime_error("Unexpected end of QOI data");
+                }
+                const uint8_t op = data[pos++];
+                if (op == 0xfe || op == 0xff) {
+                    // QOI_OP_RGB / QOI_OP_RGBA
+                    const size_t num = op == 0xfe ? 3 : 4;
+                    if (pos + num > size) {
+                        throw std::runtime_error("Unexpected end of QOI data");
+                    }
+                    memcpy(px, data + pos, num);
+                    pos += num;
+                } else if ((op & 0xc0) == 0x00) {
+                    // QOI_OP_INDEX
+                    memcpy(px, index[op], sizeof(px));
+                } else if ((op & 0xc0) == 0x40) {
+                    // QOI_OP_DIFF
+                    px[0] += ((op >> 4) & 3) - 2;
+                    px[1] += ((op >> 2) & 3) - 2;
+                    px[2] += (op & 3) - 2;
+                } else if ((op & 0xc0) == 0x80) {
+                    // QOI_OP_LUMA
+                    if (pos >= size) {
+                        throw std::runtime_error("Unexpected end of QOI data");
+                    }
+                    const uint8_t op2 = data[pos++];
+                    const int dg = (op & 0x3f) - 32;
+                    px[0] += dg - 8 + ((op2 >> 4) & 0x0f);
+                    px[1] += dg;
+                    px[2] += dg - 8 + (op2 & 0x0f);
+                } else {
+                    // QOI_OP_RUN
+                    run = op & 0x3f;
+                }
+                memcpy(index[(px[0] * 3 + px[1] * 5 + px[2] * 7 + px[3] * 11) % 64], px,
+                       sizeof(px));
+            }
+            dst[x] = pixel_traits<pixel_layout::rgba>::load(px, nullptr);
+        }
+        if (y && y % progress_rows == 0) {
+            report(progress, y);
+        }
+    }
 }
-#endif // HAVE_LIBGIF
 
 /** @brief List of image loader handlers. */
 static const loader loaders[] = {
     { "JPEG (libjpeg)",
 #ifdef HAVE_LIBJPEG
-        jpg_check, jpg_load
+        jpg_check, jpg_load, jpg_probe
 #else
-        nullptr, nullptr
+        nullptr, nullptr, nullptr
 #endif // HAVE_LIBJPEG
     },
     { "PNG (libpng)",
 #ifdef HAVE_LIBPNG
-        png_check, png_load
+        png_check, png_load, png_probe
 #else
-        nullptr, nullptr
+        nullptr, nullptr, nullptr
 #endif // HAVE_LIBPNG
     },
     { "GIF (libgif)",
 #ifdef HAVE_LIBGIF
-        gif_check, gif_load
+        gif_check, gif_load, gif_probe
 #else
-        nullptr, nullptr
+        nullptr, nullptr, nullptr
 #endif // HAVE_LIBGIF
     },
+    { "WebP (libwebp)",
+#ifdef HAVE_LIBWEBP
+        webp_check, webp_load, webp_probe
+#else
+        nullptr, nullptr, nullptr
+#endif // HAVE_LIBWEBP
+    },
+    { "AVIF (libavif)",
+#ifdef HAVE_LIBAVIF
+        avif_check, avif_load, avif_probe
+#else
+        nullptr, nullptr, nullptr
+#endif // HAVE_LIBAVIF
+    },
+    { "HEIF (libheif)",
+#ifdef HAVE_LIBHEIF
+        heif_check, heif_load, heif_probe
+#else
+        nullptr, nullptr, nullptr
+#endif // HAVE_LIBHEIF
+    },
+    { "QOI (built-in)", qoi_check, qoi_load, qoi_probe },
 };
 
-image load_image(const char* file)
+void load_image(const uint8_t* data, size_t size, image& img,
+                const load_progress_fn& progress,
+                size_t fit_w /*= 0*/, size_t fit_h /*= 0*/)
 {
-    std::unique_ptr<FILE, int (*)(FILE*)> fd(fopen(file, "rb"), fclose);
-    if (!fd) {
-        throw std::system_error(errno, std::system_category());
+    loader::file_header_t header;
+    if (size < header.size()) {
+        throw std::runtime_error("Invalid image file");
     }
+    memcpy(header.data(), data, header.size());
 
-    loader::file_header_t header;
-    if (fread(header.data(), 1, header.size(), fd.get()) != header.size()) {
-        if (errno) {
-            throw std::system_error(errno, std::system_category());
-        } else {
-            throw std::runtime_error("Invalid image file");
+    for (auto& it : loaders) {
+        if (it.check && it.check(header)) {
+            STATS_SCOPE(decode);
+            it.load(data, size, img, fit_w, fit_h, progress);
+            report(progress, img.height);
+            return;
         }
     }
-    rewind(fd.get());
+
+    throw std::runtime_error("Unsupported format");
+}
+
+void load_image(const char* file, image& img, const load_progress_fn& progress,
+                size_t fit_w /*= 0*/, size_t fit_h /*= 0*/)
+{
+    const file_data fd(file);
+    load_image(fd.data(), fd.size(), img, progress, fit_w, fit_h);
+}
+
+image load_image(const char* file, size_t fit_w /*= 0*/, size_t fit_h /*= 0*/)
+{
+    image img;
+    load_image(file, img, load_progress_fn(), fit_w, fit_h);
+    if (img.transparent) {
+        // skip background compositing for opaque images
+        img.transparent = img.has_transparency();
+    }
+    return img;
+}
+
+bool probe_image(const uint8_t* data, size_t size, image_info& info)
+{
+    loader::file_header_t header;
+    if (size < header.size()) {
+        return false;
+    }
+    memcpy(header.data(), data, header.size());
 
     for (auto& it : loaders) {
         if (it.check && it.check(header)) {
-            return it.load(fd.get());
+            info = image_info();
+            info.format = it.desc;
+            return it.probe(data, size, info);
         }
     }
+    return false;
+}
 
-    throw std::runtime_error("Unsupported format");
+bool probe_image(const char* file, image_info& info)
+{
+    const file_data fd(file);
+    return probe_image(fd.data(), fd.size(), info);
 }
 
 void print_formats()
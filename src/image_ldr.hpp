@@ -5,17 +5,112 @@
 
 #include "image.hpp"
 
+#include <functional>
+
+/**
+ * @brief Callback for decoding progress notifications.
+ *
+ * @param[in] rows number of decoded rows, 0 means that the image size is
+ *                 known and the pixel buffer is allocated
+ *
+ * @return false to abort decoding
+ */
+using load_progress_fn = std::function<bool(size_t rows)>;
+
+/**
+ * @struct image_info
+ * @brief Image properties read from the file headers.
+ */
+struct image_info {
+    /** @brief Format description. */
+    const char* format = nullptr;
+    /** @brief Size of the image. */
+    size_t width = 0;
+    size_t height = 0;
+    /** @brief Flag indicated that the image has alpha channel. */
+    bool alpha = false;
+    /** @brief EXIF orientation (1-8), 1 if not specified. */
+    int orientation = 1;
+};
+
 /**
  * @brief Load image from file.
  *
- * @param[in] file path to the file to load
+ * @param[in] file path to the file to load, "-" to read from stdin
+ * @param[in] fit_w width of the area to fit the image in, 0 to decode full size
+ * @param[in] fit_h height of the area to fit the image in, 0 to decode full size
+ *
+ * Decoders that support fast decoding at reduced size (JPEG) use the
+ * smallest size that still covers the image scaled to fit the area, check
+ * image::full_width/full_height to get the size of the original image.
  *
  * @throw std::system_error if file operation fails
  * @throw std::runtime_error on format error
  *
  * @return image instance
  */
-image load_image(const char* file);
+image load_image(const char* file, size_t fit_w = 0, size_t fit_h = 0);
+
+/**
+ * @brief Load image from file with progress notifications, used to show
+ *        the image while it is being decoded.
+ *
+ * Size of the image and its pixel buffer are set before the first
+ * notification and never changed after it. Rows are filled top-down, so
+ * the rows reported by the last notification can be safely read from
+ * another thread. Unlike the function above, transparency flag is set
+ * according to the format and is not checked against the pixels.
+ *
+ * @param[in] file path to the file to load, "-" to read from stdin
+ * @param[out] img image to decode into
+ * @param[in] progress callback for progress notifications
+ * @param[in] fit_w width of the area to fit the image in, 0 to decode full size
+ * @param[in] fit_h height of the area to fit the image in, 0 to decode full size
+ *
+ * @throw std::system_error if file operation fails
+ * @throw std::runtime_error on format error or if decoding was aborted
+ */
+void load_image(const char* file, image& img, const load_progress_fn& progress,
+                size_t fit_w = 0, size_t fit_h = 0);
+
+/**
+ * @brief Load image from memory with progress notifications.
+ *
+ * @param[in] data image file data
+ * @param[in] size size of the image file data
+ * @param[out] img image to decode into
+ * @param[in] progress callback for progress notifications
+ * @param[in] fit_w width of the area to fit the image in, 0 to decode full size
+ * @param[in] fit_h height of the area to fit the image in, 0 to decode full size
+ *
+ * @throw std::runtime_error on format error or if decoding was aborted
+ */
+void load_image(const uint8_t* data, size_t size, image& img,
+                const load_progress_fn& progress,
+                size_t fit_w = 0, size_t fit_h = 0);
+
+/**
+ * @brief Get image properties from the file headers without decoding.
+ *
+ * @param[in] data image file data
+ * @param[in] size size of the image file data
+ * @param[out] info image properties
+ *
+ * @return false if the format is not supported or headers are invalid
+ */
+bool probe_image(const uint8_t* data, size_t size, image_info& info);
+
+/**
+ * @brief Get image properties from the file headers without decoding.
+ *
+ * @param[in] file path to the file to probe, "-" to read from stdin
+ * @param[out] info image properties
+ *
+ * @throw std::system_error if file operation fails
+ *
+ * @return false if the format is not supported or headers are invalid
+ */
+bool probe_image(const char* file, image_info& info);
 
 /**
  * @brief Print list of supported formats.
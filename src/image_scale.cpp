@@ -0,0 +1,462 @@
+// SPDX-License-Identifier: Apache-2.0
+// Copyright (C) 2020 Artem Senichev <artemsen@gmail.com>
+
+#include "image_scale.hpp"
+#include "cpu.hpp"
+#include "thread_pool.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <vector>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define SCALE_X86
+#include <immintrin.h>
+#endif
+
+using rgba_t = image::rgba_t;
+
+/** @brief Number of fraction bits in fixed point coordinates. */
+constexpr size_t frac_bits = 8;
+/** @brief Fixed point 1.0. */
+constexpr uint32_t frac_one = 1 << frac_bits;
+/** @brief Max number of pixels composited with a single pattern chunk. */
+constexpr size_t grid_chunk = 256;
+
+/**
+ * @brief Row kernel of nearest neighbor filter.
+ *
+ * @param[in] src source row
+ * @param[in] cols table of source column indices
+ * @param[out] dst destination row
+ * @param[in] w number of pixels to render
+ */
+using nearest_fn = void (*)(const rgba_t* src, const uint32_t* cols, rgba_t* dst, size_t w);
+
+/**
+ * @brief Row kernel of bilinear filter.
+ *
+ * @param[in] r0 upper source row
+ * @param[in] r1 lower source row
+ * @param[in] fy vertical weight of the lower row
+ * @param[in] cols table of left source column indices
+ * @param[in] fx table of horizontal weights of the right column
+ * @param[out] dst destination row
+ * @param[in] w number of pixels to render
+ */
+using bilinear_fn = void (*)(const rgba_t* r0, const rgba_t* r1, uint32_t fy,
+                             const uint32_t* cols, const uint16_t* fx,
+                             rgba_t* dst, size_t w);
+
+static void nearest_row(const rgba_t* src, const uint32_t* cols, rgba_t* dst, size_t w)
+{
+    for (size_t i = 0; i < w; ++i) {
+        dst[i] = src[cols[i]];
+    }
+}
+
+/** @brief Linear interpolation of two pixels, f is the weight of b. */
+static inline rgba_t lerp(rgba_t a, rgba_t b, uint32_t f)
+{
+    const uint32_t nf = frac_one - f;
+    const uint32_t rb = (((a & 0x00ff00ff) * nf + (b & 0x00ff00ff) * f) >> frac_bits) & 0x00ff00ff;
+    const uint32_t ag = (((a >> 8) & 0x00ff00ff) * nf + ((b >> 8) & 0x00ff00ff) * f) & 0xff00ff00;
+    return rb | ag;
+}
+
+static void bilinear_row(const rgba_t* r0, const rgba_t* r1, uint32_t fy,
+                         const uint32_t* cols, const uint16_t* fx,
+                         rgba_t* dst, size_t w)
+{
+    for (size_t i = 0; i < w; ++i) {
+        const uint32_t c = cols[i];
+        const rgba_t top = lerp(r0[c], r0[c + 1], fx[i]);
+        const rgba_t bottom = lerp(r1[c], r1[c + 1], fx[i]);
+        dst[i] = lerp(top, bottom, fy);
+    }
+}
+
+#ifdef SCALE_X86
+__attribute__((target("avx2")))
+static void nearest_row_avx2(const rgba_t* src, const uint32_t* cols, rgba_t* dst, size_t w)
+{
+    const int* base = reinterpret_cast<const int*>(src);
+    size_t i = 0;
+    for (; i + 8 <= w; i += 8) {
+        const __m256i idx = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(cols + i));
+        const __m256i px = _mm256_i32gather_epi32(base, idx, sizeof(rgba_t));
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + i), px);
+    }
+    nearest_row(src, cols + i, dst + i, w - i);
+}
+
+__attribute__((target("sse2")))
+static void bilinear_row_sse2(const rgba_t* r0, const rgba_t* r1, uint32_t fy,
+                              const uint32_t* cols, const uint16_t* fx,
+                              rgba_t* dst, size_t w)
+{
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i wy1 = _mm_set1_epi16(static_cast<short>(fy));
+    const __m128i wy0 = _mm_set1_epi16(static_cast<short>(frac_one - fy));
+
+    for (size_t i = 0; i < w; ++i) {
+        // two adjacent pixels from each row, 16 bits per channel
+        const uint32_t c = cols[i];
+        const __m128i top = _mm_unpacklo_epi8(
+            _mm_loadl_epi64(reinterpret_cast<const __m128i*>(r0 + c)), zero);
+        const __m128i bottom = _mm_unpacklo_epi8(
+            _mm_loadl_epi64(reinterpret_cast<const __m128i*>(r1 + c)), zero);
+
+        // vertical pass
+        __m128i px = _mm_add_epi16(_mm_mullo_epi16(top, wy0), _mm_mullo_epi16(bottom, wy1));
+        px = _mm_srli_epi16(px, frac_bits);
+
+        // horizontal pass: low half is left pixel, high half is right one
+        const short f1 = static_cast<short>(fx[i]);
+        const short f0 = static_cast<short>(frac_one - fx[i]);
+        const __m128i wx = _mm_set_epi16(f1, f1, f1, f1, f0, f0, f0, f0);
+        px = _mm_mullo_epi16(px, wx);
+        px = _mm_add_epi16(px, _mm_srli_si128(px, 8));
+        px = _mm_srli_epi16(px, frac_bits);
+
+        dst[i] = _mm_cvtsi128_si32(_mm_packus_epi16(px, zero));
+    }
+}
+#endif // SCALE_X86
+
+/**
+ * @brief Row kernel of alpha blending.
+ *
+ * @param[in,out] row pixels to composite
+ * @param[in] bkg background pixels
+ * @param[in] w number of pixels in the row
+ */
+using blend_fn = void (*)(rgba_t* row, const rgba_t* bkg, size_t w);
+
+static void blend_row(rgba_t* row, const rgba_t* bkg, size_t w)
+{
+    for (size_t i = 0; i < w; ++i) {
+        const rgba_t px = row[i];
+        const uint32_t alpha = px >> 24;
+        if (alpha != 0xff) {
+            const uint32_t ra = 255 - alpha;
+            rgba_t out = 0xff000000;
+            for (size_t shift = 0; shift < 24; shift += 8) {
+                const uint32_t v = ((px >> shift) & 0xff) * alpha +
+                                   ((bkg[i] >> shift) & 0xff) * ra + 128;
+                out |= ((v + (v >> 8)) >> 8) << shift;
+            }
+            row[i] = out;
+        }
+    }
+}
+
+#ifdef SCALE_X86
+/** @brief Blend 2 pixels (16 bits per channel), result is divided by 255. */
+__attribute__((target("sse2")))
+static inline __m128i blend_sse2(__m128i px, __m128i bkg)
+{
+    const __m128i mask = _mm_set1_epi16(0xff);
+    const __m128i round = _mm_set1_epi16(128);
+    __m128i alpha = _mm_shufflelo_epi16(px, _MM_SHUFFLE(3, 3, 3, 3));
+    alpha = _mm_shufflehi_epi16(alpha, _MM_SHUFFLE(3, 3, 3, 3));
+    const __m128i ralpha = _mm_xor_si128(alpha, mask);
+    __m128i v = _mm_add_epi16(_mm_mullo_epi16(px, alpha), _mm_mullo_epi16(bkg, ralpha));
+    v = _mm_add_epi16(v, round);
+    return _mm_srli_epi16(_mm_add_epi16(v, _mm_srli_epi16(v, 8)), 8);
+}
+
+__attribute__((target("sse2")))
+static void blend_row_sse2(rgba_t* row, const rgba_t* bkg, size_t w)
+{
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i opaque = _mm_set1_epi32(0xff000000);
+
+    size_t i = 0;
+    for (; i + 4 <= w; i += 4) {
+        __m128i* ptr = reinterpret_cast<__m128i*>(row + i);
+        const __m128i px = _mm_loadu_si128(ptr);
+        const __m128i alpha = _mm_and_si128(px, opaque);
+        if (_mm_movemask_epi8(_mm_cmpeq_epi32(alpha, opaque)) == 0xffff) {
+            continue; // all pixels are opaque
+        }
+        const __m128i bg = _mm_loadu_si128(reinterpret_cast<const __m128i*>(bkg + i));
+        const __m128i lo = blend_sse2(_mm_unpacklo_epi8(px, zero), _mm_unpacklo_epi8(bg, zero));
+        const __m128i hi = blend_sse2(_mm_unpackhi_epi8(px, zero), _mm_unpackhi_epi8(bg, zero));
+        _mm_storeu_si128(ptr, _mm_or_si128(_mm_packus_epi16(lo, hi), opaque));
+    }
+    blend_row(row + i, bkg + i, w - i);
+}
+#endif // SCALE_X86
+
+/**
+ * @brief Get the fastest alpha blending kernel supported by CPU.
+ */
+static blend_fn select_blend()
+{
+#ifdef SCALE_X86
+    if (cpu_supports(cpu_isa::sse2)) {
+        return blend_row_sse2;
+    }
+#endif // SCALE_X86
+    return blend_row;
+}
+
+/**
+ * @brief Get the fastest nearest filter kernel supported by CPU.
+ */
+static nearest_fn select_nearest()
+{
+#ifdef SCALE_X86
+    if (cpu_supports(cpu_isa::avx2)) {
+        return nearest_row_avx2;
+    }
+#endif // SCALE_X86
+    return nearest_row;
+}
+
+/**
+ * @brief Get the fastest bilinear filter kernel supported by CPU.
+ */
+static bilinear_fn select_bilinear()
+{
+#ifdef SCALE_X86
+    if (cpu_supports(cpu_isa::sse2)) {
+        return bilinear_row_sse2;
+    }
+#endif // SCALE_X86
+    return bilinear_row;
+}
+
+/**
+ * @brief Calculate fixed point position of the pixel center on the source.
+ *
+ * @param[in] pos coordinate on the scaled image
+ * @param[in] src_sz source size
+ * @param[in] dst_sz scaled size
+ * @param[out] weight weight of the next source pixel
+ *
+ * @return index of the source pixel
+ */
+static uint32_t bilinear_pos(size_t pos, size_t src_sz, size_t dst_sz, uint16_t& weight)
+{
+    const uint64_t center = ((2 * pos + 1) * src_sz << frac_bits) / (2 * dst_sz);
+    const uint64_t fixed = center > frac_one / 2 ? center - frac_one / 2 : 0;
+    uint32_t idx = fixed >> frac_bits;
+    weight = fixed & (frac_one - 1);
+    if (idx >= src_sz - 1) {
+        idx = src_sz - 2;
+        weight = frac_one;
+    }
+    return idx;
+}
+
+static void scale_nearest(const image& src, rgba_t* dst, size_t stride,
+                          size_t scaled_w, size_t scaled_h,
+                          size_t x, size_t y, size_t w, size_t h)
+{
+    static const nearest_fn kernel = select_nearest();
+
+    if (scaled_w == src.width && scaled_h == src.height) {
+        // original size: just copy the area
+        for (size_t i = 0; i < h; ++i) {
+            memcpy(dst + i * stride, &src.data[(y + i) * src.width + x], w * sizeof(rgba_t));
+        }
+        return;
+    }
+
+    std::vector<uint32_t> cols(w);
+    for (size_t i = 0; i < w; ++i) {
+        cols[i] = (x + i) * src.width / scaled_w;
+    }
+
+    size_t prev_row = src.height;
+    for (size_t i = 0; i < h; ++i) {
+        rgba_t* dst_row = dst + i * stride;
+        const size_t row = (y + i) * src.height / scaled_h;
+        if (row == prev_row) {
+            // upscaled image: reuse the previous row
+            memcpy(dst_row, dst_row - stride, w * sizeof(rgba_t));
+        } else {
+            kernel(&src.data[row * src.width], cols.data(), dst_row, w);
+            prev_row = row;
+        }
+    }
+}
+
+static void scale_bilinear(const image& src, rgba_t* dst, size_t stride,
+                           size_t scaled_w, size_t scaled_h,
+                           size_t x, size_t y, size_t w, size_t h)
+{
+    static const bilinear_fn kernel = select_bilinear();
+
+    std::vector<uint32_t> cols(w);
+    std::vector<uint16_t> fx(w);
+    for (size_t i = 0; i < w; ++i) {
+        cols[i] = bilinear_pos(x + i, src.width, scaled_w, fx[i]);
+    }
+
+    for (size_t i = 0; i < h; ++i) {
+        uint16_t fy;
+        const size_t row = bilinear_pos(y + i, src.height, scaled_h, fy);
+        const rgba_t* r0 = &src.data[row * src.width];
+        kernel(r0, r0 + src.width, fy, cols.data(), fx.data(), dst + i * stride, w);
+    }
+}
+
+static void scale_area(const image& src, rgba_t* dst, size_t stride,
+                       size_t scaled_w, size_t scaled_h,
+                       size_t x, size_t y, size_t w, size_t h)
+{
+    // source column ranges for each destination pixel
+    std::vector<uint32_t> cols(w + 1);
+    for (size_t i = 0; i <= w; ++i) {
+        cols[i] = (x + i) * src.width / scaled_w;
+    }
+    const size_t col_first = cols[0];
+    const size_t col_last = std::max<size_t>(cols[w], cols[w - 1] + 1);
+
+    // per channel sums of source columns
+    std::vector<uint32_t> sums((col_last - col_first) * 4);
+
+    for (size_t i = 0; i < h; ++i) {
+        size_t row_first = (y + i) * src.height / scaled_h;
+        size_t row_last = (y + i + 1) * src.height / scaled_h;
+        if (row_last <= row_first) {
+            row_last = row_first + 1;
+        }
+
+        std::fill(sums.begin(), sums.end(), 0);
+        for (size_t row = row_first; row < row_last; ++row) {
+            const rgba_t* src_row = &src.data[row * src.width + col_first];
+            uint32_t* sum = sums.data();
+            for (size_t col = col_first; col < col_last; ++col) {
+                const rgba_t px = *src_row++;
+                *sum++ += px & 0xff;
+                *sum++ += (px >> 8) & 0xff;
+                *sum++ += (px >> 16) & 0xff;
+                *sum++ += px >> 24;
+            }
+        }
+
+        rgba_t* dst_row = dst + i * stride;
+        for (size_t j = 0; j < w; ++j) {
+            const size_t begin = cols[j];
+            const size_t end = std::max<size_t>(cols[j + 1], begin + 1);
+            uint32_t acc[4] = { 0, 0, 0, 0 };
+            const uint32_t* sum = &sums[(begin - col_first) * 4];
+            for (size_t col = begin; col < end; ++col) {
+                acc[0] += *sum++;
+                acc[1] += *sum++;
+                acc[2] += *sum++;
+                acc[3] += *sum++;
+            }
+            // division through reciprocal multiplication
+            const uint64_t count = (end - begin) * (row_last - row_first);
+            const uint64_t rcp = ((1ull << 32) + count - 1) / count;
+            dst_row[j] = static_cast<rgba_t>((acc[0] * rcp) >> 32) |
+                         static_cast<rgba_t>((acc[1] * rcp) >> 32) << 8 |
+                         static_cast<rgba_t>((acc[2] * rcp) >> 32) << 16 |
+                         static_cast<rgba_t>((acc[3] * rcp) >> 32) << 24;
+        }
+    }
+}
+
+grid::grid(size_t step /*= 10*/, image::rgba_t clr /*= 0x404040*/)
+    : step_(step)
+    , period_(step * 2)
+{
+    const image::rgba_t clr2 = clr - 0x00101010;
+    for (size_t i = 0; i < 2; ++i) {
+        rows_[i].resize(period_ + grid_chunk);
+        for (size_t x = 0; x < rows_[i].size(); ++x) {
+            rows_[i][x] = ((x / step_) % 2 != i) ? clr : clr2;
+        }
+    }
+}
+
+void grid::blend(image::rgba_t* row, size_t x, size_t y, size_t w) const
+{
+    static const blend_fn kernel = select_blend();
+
+    const image::rgba_t* pattern = rows_[(y / step_) % 2].data();
+    while (w) {
+        const size_t len = std::min(w, grid_chunk);
+        kernel(row, pattern + x % period_, len);
+        row += len;
+        x += len;
+        w -= len;
+    }
+}
+
+image grid::tile() const
+{
+    image img;
+    img.width = img.full_width = period_;
+    img.height = img.full_height = period_;
+    img.data.resize(period_ * period_);
+    for (size_t y = 0; y < period_; ++y) {
+        const image::rgba_t* pattern = rows_[(y / step_) % 2].data();
+        for (size_t x = 0; x < period_; ++x) {
+            img.data[y * period_ + x] = pattern[x] | 0xff000000;
+        }
+    }
+    return img;
+}
+
+bool scale_filter_parse(const char* name, scale_filter& filter)
+{
+    if (strcmp(name, "nearest") == 0) {
+        filter = scale_filter::nearest;
+    } else if (strcmp(name, "bilinear") == 0) {
+        filter = scale_filter::bilinear;
+    } else if (strcmp(name, "area") == 0) {
+        filter = scale_filter::area;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+void scale_image(const image& src, image::rgba_t* dst, size_t stride,
+                 size_t scaled_w, size_t scaled_h,
+                 size_t x, size_t y, size_t w, size_t h,
+                 scale_filter filter, const grid* bkg /*= nullptr*/)
+{
+    if (!w || !h) {
+        return;
+    }
+
+    // bilinear filter requires at least 2x2 source
+    if (filter == scale_filter::bilinear && (src.width < 2 || src.height < 2)) {
+        filter = scale_filter::nearest;
+    }
+    // no filtering required for original size
+    if (scaled_w == src.width && scaled_h == src.height) {
+        filter = scale_filter::nearest;
+    }
+
+    // split rows between threads
+    thread_pool::parallel(h, [&](size_t begin, size_t end) {
+        rgba_t* tile = dst + begin * stride;
+        const size_t tile_y = y + begin;
+        const size_t tile_h = end - begin;
+        switch (filter) {
+            case scale_filter::nearest:
+                scale_nearest(src, tile, stride, scaled_w, scaled_h, x, tile_y, w, tile_h);
+                break;
+            case scale_filter::bilinear:
+                scale_bilinear(src, tile, stride, scaled_w, scaled_h, x, tile_y, w, tile_h);
+                break;
+            case scale_filter::area:
+                scale_area(src, tile, stride, scaled_w, scaled_h, x, tile_y, w, tile_h);
+                break;
+        }
+        // composite while the tile is still in cache
+        if (bkg) {
+            for (size_t i = 0; i < tile_h; ++i) {
+                bkg->blend(tile + i * stride, x, tile_y + i, w);
+            }
+        }
+    });
+}
@@ -0,0 +1,87 @@
+// SPDX-License-Identifier: Apache-2.0
+// Copyright (C) 2020 Artem Senichev <artemsen@gmail.com>
+
+#pragma once
+
+#include "image.hpp"
+
+#include <vector>
+
+/** @brief Scale filter types. */
+enum class scale_filter {
+    nearest,  ///< Nearest neighbor (fastest)
+    bilinear, ///< Bilinear interpolation
+    area      ///< Area averaging (best for downscaling)
+};
+
+/**
+ * @class grid
+ * @brief Checkerboard used as a background for transparent images.
+ *        The pattern is precomputed once and reused for each render.
+ */
+class grid {
+public:
+    /**
+     * @brief Constructor.
+     *
+     * @param[in] step grid step (size of a single cell)
+     * @param[in] clr grid color
+     */
+    grid(size_t step = 10, image::rgba_t clr = 0x404040);
+
+    /**
+     * @brief Composite row of pixels over the grid.
+     *
+     * @param[in,out] row pixels to composite
+     * @param[in] x horizontal coordinate of the first pixel on the grid
+     * @param[in] y vertical coordinate of the row on the grid
+     * @param[in] w number of pixels in the row
+     */
+    void blend(image::rgba_t* row, size_t x, size_t y, size_t w) const;
+
+    /**
+     * @brief Get single period of the pattern as an opaque image, used as a
+     *        repeated tile for drawing on the server side.
+     *
+     * @return image with the grid tile
+     */
+    image tile() const;
+
+private:
+    /** @brief Grid step. */
+    size_t step_;
+    /** @brief Pattern period (two cells). */
+    size_t period_;
+    /** @brief Pattern rows for even and odd cell rows. */
+    std::vector<image::rgba_t> rows_[2];
+};
+
+/**
+ * @brief Get scale filter by its name.
+ *
+ * @param[in] name filter name
+ * @param[out] filter filter type
+ *
+ * @return false if name is unknown
+ */
+bool scale_filter_parse(const char* name, scale_filter& filter);
+
+/**
+ * @brief Render area of the scaled image into the buffer.
+ *
+ * @param[in] src source image
+ * @param[out] dst destination buffer (top-left pixel of the area)
+ * @param[in] stride size of the destination row in pixels
+ * @param[in] scaled_w width of the whole scaled image
+ * @param[in] scaled_h height of the whole scaled image
+ * @param[in] x left coordinate of the area to render on the scaled image
+ * @param[in] y top coordinate of the area to render on the scaled image
+ * @param[in] w width of the area to render
+ * @param[in] h height of the area to render
+ * @param[in] filter scale filter to use
+ * @param[in] bkg background to composite with, nullptr to leave alpha as is
+ */
+void scale_image(const image& src, image::rgba_t* dst, size_t stride,
+                 size_t scaled_w, size_t scaled_h,
+                 size_t x, size_t y, size_t w, size_t h,
+                 scale_filter filter, const grid* bkg = nullptr);
@@ -2,12 +2,23 @@
 // Copyright (C) 2020 Artem Senichev <artemsen@gmail.com>
 
 #include "viewer.hpp"
+#include "bench.hpp"
+#include "daemon.hpp"
+#include "file_data.hpp"
 #include "image_ldr.hpp"
+#include "stats.hpp"
+#include "trace.hpp"
 
+#include <algorithm>
+#include <cerrno>
+#include <cstdint>
 #include <cstdio>
 #include <cstdlib>
+#include <cstring>
+#include <dirent.h>
 #include <exception>
 #include <getopt.h>
+#include <sys/stat.h>
 
 /**
  * @brief Print help usage info.
@@ -17,11 +28,27 @@
 static void print_help(const char* app)
 {
     puts("Picterm - preview images in terminal window.");
-    printf("Usage: %s [OPTION...] FILE\n", app);
+    printf("Usage: %s [OPTION...] FILE...\n", app);
+    puts("FILE can be a directory or `-` to read image from stdin.");
     puts("Default values are specified in brackets.");
     puts("  -b, --border=N         Window border size in pixels [0]");
     puts("  -s, --scale=PERCENT    Set initiial image scale [0:auto]");
     puts("  -e, --exit-unfocus     Exit if window lost focus [off]");
+    puts("  -p, --viewport         Always render only visible part of image [auto]");
+    puts("  -f, --filter=NAME      Scale filter: nearest, bilinear or area [nearest]");
+    puts("  -t, --threads=N        Number of image processing threads [0:auto]");
+    puts("  -P, --preview          Fast preview: decode at reduced size if possible [off]");
+    puts("  -c, --cache=MB         Memory limit for prefetched images [256]");
+    puts("  -C, --disk-cache       Cache previews on disk to show images faster [off]");
+    puts("  -m, --max-memory=MB    Memory budget for all image buffers [0:unlimited]");
+    puts("  -x, --pixmap           Keep rendered frame on X server to repaint faster [off]");
+    puts("  -r, --xrender          Scale image on X server with XRender [off]");
+    puts("      --stats            Log frame time and stages breakdown to stderr [off]");
+    puts("      --startup-trace    Print timing of startup steps to stderr [off]");
+    puts("      --bench[=json]     Benchmark processing stages on FILE(s) and exit");
+    puts("      --info             Print size, alpha and orientation of FILE(s) and exit");
+    puts("      --daemon           Serve requests from clients, keeping caches warm");
+    puts("      --client           Show FILE(s) with the running daemon if possible");
     puts("  -v, --version          Print version info and supported formats list");
     puts("  -h, --help             Print this help and exit");
 }
@@ -37,22 +64,142 @@ static void print_version()
     print_formats();
 }
 
+/** @brief Max number of processing threads. */
+constexpr size_t max_threads = 1024;
+/** @brief Max size in megabytes (the size in bytes must fit size_t). */
+constexpr size_t max_megabytes = SIZE_MAX / (1024 * 1024);
+
+/**
+ * @brief Parse unsigned decimal number.
+ *
+ * @param[in] str string to parse
+ * @param[in] max max allowed value
+ * @param[out] val parsed value
+ *
+ * @return false if the string is not a number or it is out of range
+ */
+static bool parse_number(const char* str, size_t max, size_t& val)
+{
+    if (*str < '0' || *str > '9') {
+        return false; // strtoul accepts sign and leading spaces
+    }
+    char* end;
+    errno = 0;
+    const unsigned long num = strtoul(str, &end, 10);
+    if (errno || *end || num > max) {
+        return false;
+    }
+    val = num;
+    return true;
+}
+
+/**
+ * @brief Add path to the file list, directories are expanded to the sorted
+ *        list of files they contain (not recursively).
+ *
+ * @param[in] path path to add
+ * @param[out] files file list
+ */
+static void add_path(const char* path, std::vector<std::string>& files)
+{
+    struct stat st;
+    if (strcmp(path, file_data::stdin_name) == 0 || stat(path, &st) == -1 ||
+        !S_ISDIR(st.st_mode)) {
+        files.push_back(path);  // errors will be reported on load
+        return;
+    }
+
+    DIR* dir = opendir(path);
+    if (!dir) {
+        files.push_back(path);
+        return;
+    }
+
+    std::vector<std::string> entries;
+    std::string dir_path = path;
+    if (dir_path.back() != '/') {
+        dir_path += '/';
+    }
+    while (const dirent* de = readdir(dir)) {
+        if (de->d_name[0] == '.') {
+            continue; // skip hidden files
+        }
+        const std::string file = dir_path + de->d_name;
+        if (stat(file.c_str(), &st) == 0 && S_ISREG(st.st_mode)) {
+            entries.push_back(file);
+        }
+    }
+    closedir(dir);
+
+    std::sort(entries.begin(), entries.end());
+    files.insert(files.end(), entries.begin(), entries.end());
+}
+
+/**
+ * @brief Print image properties read from the file headers.
+ *
+ * @param[in] files list of files to probe
+ *
+ * @return false if any file can't be probed
+ */
+static bool print_info(const std::vector<std::string>& files)
+{
+    bool rc = true;
+    for (const std::string& file : files) {
+        image_info info;
+        try {
+            if (!probe_image(file.c_str(), info)) {
+                fprintf(stderr, "%s: Unsupported format\n", file.c_str());
+                rc = false;
+                continue;
+            }
+        } catch (const std::exception& ex) {
+            fprintf(stderr, "%s: %s\n", file.c_str(), ex.what());
+            rc = false;
+            continue;
+        }
+        printf("%s: %s, %zux%zu, %s, orientation %d\n", file.c_str(), info.format,
+               info.width, info.height, info.alpha ? "alpha" : "opaque", info.orientation);
+    }
+    return rc;
+}
+
 /** @brief Application entry point. */
 int main(int argc, char* argv[])
 {
     viewer view;
+    bool bench_mode = false;
+    bool bench_json = false;
+    bool daemon_mode = false;
+    bool info_mode = false;
+    bool client_mode = false;
 
     // clang-format off
     const struct option longOpts[] = {
         {"border",       required_argument, nullptr, 'b'},
         {"scale",        required_argument, nullptr, 's'},
         {"exit-unfocus", no_argument,       nullptr, 'e'},
+        {"viewport",     no_argument,       nullptr, 'p'},
+        {"filter",       required_argument, nullptr, 'f'},
+        {"threads",      required_argument, nullptr, 't'},
+        {"preview",      no_argument,       nullptr, 'P'},
+        {"cache",        required_argument, nullptr, 'c'},
+        {"disk-cache",   no_argument,       nullptr, 'C'},
+        {"max-memory",   required_argument, nullptr, 'm'},
+        {"pixmap",       no_argument,       nullptr, 'x'},
+        {"xrender",      no_argument,       nullptr, 'r'},
+        {"stats",        no_argument,       nullptr, 'S'},
+        {"startup-trace", no_argument,      nullptr, 'T'},
+        {"bench",        optional_argument, nullptr, 'B'},
+        {"info",         no_argument,       nullptr, 'I'},
+        {"daemon",       no_argument,       nullptr, 'D'},
+        {"client",       no_argument,       nullptr, 'K'},
         {"version",      no_argument,       nullptr, 'v'},
         {"help",         no_argument,       nullptr, 'h'},
         {nullptr,        0,                 nullptr,  0 }
     };
     // clang-format on
-    const char* shortOpts = "b:s:evh";
+    const char* shortOpts = "b:s:epf:t:Pc:Cm:xrvh";
 
     opterr = 0; // prevent native error messages
 
@@ -69,6 +216,77 @@ int main(int argc, char* argv[])
             case 'e':
                 view.exit_unfocus = true;
                 break;
+            case 'p':
+                view.viewport = true;
+                break;
+            case 'f':
+                if (!scale_filter_parse(optarg, view.filter)) {
+                    fprintf(stderr, "Invalid filter: %s\n", optarg);
+                    return EXIT_FAILURE;
+                }
+                break;
+            case 't':
+                if (!parse_number(optarg, max_threads, view.threads)) {
+                    fprintf(stderr, "Invalid number of threads: %s\n", optarg);
+                    return EXIT_FAILURE;
+                }
+                break;
+            case 'P':
+                view.preview = true;
+                break;
+            case 'c':
+                if (!parse_number(optarg, max_megabytes, view.cache_size)) {
+                    fprintf(stderr, "Invalid cache size: %s\n", optarg);
+                    return EXIT_FAILURE;
+                }
+                view.cache_size *= 1024 * 1024;
+                break;
+            case 'C':
+                view.disk_cache = true;
+                break;
+            case 'm':
+                if (!parse_number(optarg, max_megabytes, view.max_memory)) {
+                    fprintf(stderr, "Invalid memory budget: %s\n", optarg);
+                    return EXIT_FAILURE;
+                }
+                view.max_memory *= 1024 * 1024;
+                break;
+            case 'x':
+                view.pixmap = true;
+                break;
+            case 'r':
+                view.xrender = true;
+                break;
+            case 'S':
+#ifdef ENABLE_STATS
+                stats_enable();
+                break;
+#else
+                fprintf(stderr, "Statistics are not supported, configure with --enable-stats\n");
+                return EXIT_FAILURE;
+#endif // ENABLE_STATS
+            case 'T':
+                trace_enable();
+                break;
+            case 'B':
+                bench_mode = true;
+                if (optarg) {
+                    if (strcmp(optarg, "json") != 0) {
+                        fprintf(stderr, "Invalid report format: %s\n", optarg);
+                        return EXIT_FAILURE;
+                    }
+                    bench_json = true;
+                }
+                break;
+            case 'I':
+                info_mode = true;
+                break;
+            case 'D':
+                daemon_mode = true;
+                break;
+            case 'K':
+                client_mode = true;
+                break;
             case 'v':
                 print_version();
                 return EXIT_SUCCESS;
@@ -81,23 +299,72 @@ int main(int argc, char* argv[])
             }
     }
 
+    if (daemon_mode) {
+        if (optind != argc) {
+            fprintf(stderr, "Daemon doesn't accept file names\n");
+            return EXIT_FAILURE;
+        }
+        try {
+            daemon_run(view);
+        } catch (std::exception& ex) {
+            fprintf(stderr, "Daemon failed: %s\n", ex.what());
+        }
+        return EXIT_FAILURE;
+    }
+
     if (optind == argc) {
         fprintf(stderr, "File name expected, use `%s --help`.\n", argv[0]);
         return EXIT_FAILURE;
     }
 
-    view.file_name = argv[optind];
-    if (!*view.file_name) {
-        fprintf(stderr, "File name can not be empty\n");
+    for (int i = optind; i < argc; ++i) {
+        if (!*argv[i]) {
+            fprintf(stderr, "File name can not be empty\n");
+            return EXIT_FAILURE;
+        }
+        add_path(argv[i], view.files);
+    }
+    if (view.files.empty()) {
+        fprintf(stderr, "No files to show\n");
+        return EXIT_FAILURE;
+    }
+    if (view.files.size() > 1 &&
+        std::find(view.files.begin(), view.files.end(), file_data::stdin_name) != view.files.end()) {
+        fprintf(stderr, "Stdin can not be used with other files\n");
         return EXIT_FAILURE;
     }
 
+    trace("arguments parsed");
+
+    if (info_mode) {
+        return print_info(view.files) ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+
+    if (client_mode && view.files[0] != file_data::stdin_name) {
+        // fall back to standalone mode if the daemon is not running
+        bool rc;
+        if (client_run(view.files, rc)) {
+            return rc ? EXIT_SUCCESS : EXIT_FAILURE;
+        }
+    }
+
+    if (bench_mode) {
+        const bool rc = bench(view.files, view.filter, view.threads, bench_json);
+#ifdef ENABLE_STATS
+        stats_dump();
+#endif // ENABLE_STATS
+        return rc ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+
     try {
         view.show();
     } catch (std::exception& ex) {
-        fprintf(stderr, "Unable to preview file %s: %s\n", view.file_name, ex.what());
+        fprintf(stderr, "Unable to preview file %s: %s\n", view.current_file().c_str(), ex.what());
         return EXIT_FAILURE;
     }
+#ifdef ENABLE_STATS
+    stats_dump();
+#endif // ENABLE_STATS
 
     return EXIT_SUCCESS;
 }
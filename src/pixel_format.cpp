@@ -0,0 +1,117 @@
+// SPDX-License-Identifier: Apache-2.0
+// Copyright (C) 2020 Artem Senichev <artemsen@gmail.com>
+
+#include "pixel_format.hpp"
+
+using rgba_t = image::rgba_t;
+
+/** @brief Byte order of the host. */
+constexpr bool host_msb_first = __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__;
+
+bool pixel_format::native() const
+{
+    return bpp == 32 && msb_first == host_msb_first &&
+        red_mask == 0xff0000 && green_mask == 0x00ff00 && blue_mask == 0x0000ff;
+}
+
+/**
+ * @brief Kernel for 32-bit pixels with opposite byte order.
+ */
+static void convert_swap32(const pixel_format&, const rgba_t* src, uint8_t* dst, size_t count)
+{
+    uint32_t* out = reinterpret_cast<uint32_t*>(dst);
+    for (size_t i = 0; i < count; ++i) {
+        out[i] = __builtin_bswap32(src[i]);
+    }
+}
+
+/**
+ * @brief Kernel for 32-bit pixels with swapped red and blue channels.
+ */
+static void convert_rgbx32(const pixel_format&, const rgba_t* src, uint8_t* dst, size_t count)
+{
+    uint32_t* out = reinterpret_cast<uint32_t*>(dst);
+    for (size_t i = 0; i < count; ++i) {
+        const uint32_t px = src[i];
+        out[i] = (px & 0x0000ff00) | ((px >> 16) & 0xff) | ((px & 0xff) << 16);
+    }
+}
+
+/**
+ * @brief Kernel for 16-bit RGB565 pixels.
+ *
+ * @tparam swap true if byte order of the format differs from the host one
+ */
+template <bool swap>
+static void convert_rgb565(const pixel_format&, const rgba_t* src, uint8_t* dst, size_t count)
+{
+    uint16_t* out = reinterpret_cast<uint16_t*>(dst);
+    for (size_t i = 0; i < count; ++i) {
+        const uint32_t px = src[i];
+        const uint16_t val = ((px >> 8) & 0xf800) | ((px >> 5) & 0x07e0) | ((px >> 3) & 0x001f);
+        out[i] = swap ? __builtin_bswap16(val) : val;
+    }
+}
+
+/**
+ * @brief Get position and size of the channel in the pixel.
+ *
+ * @param[in] mask channel mask
+ * @param[out] shift position of the lowest bit
+ * @param[out] bits number of bits
+ */
+static void channel_layout(uint32_t mask, int& shift, int& bits)
+{
+    shift = mask ? __builtin_ctz(mask) : 0;
+    bits = __builtin_popcount(mask);
+}
+
+/**
+ * @brief Kernel for any true color format: pixel is assembled from channel
+ *        masks and written byte by byte.
+ */
+static void convert_generic(const pixel_format& fmt, const rgba_t* src, uint8_t* dst, size_t count)
+{
+    int shift[3], bits[3];
+    channel_layout(fmt.red_mask, shift[0], bits[0]);
+    channel_layout(fmt.green_mask, shift[1], bits[1]);
+    channel_layout(fmt.blue_mask, shift[2], bits[2]);
+    const size_t bytes = fmt.bpp / 8;
+
+    for (size_t i = 0; i < count; ++i) {
+        const rgba_t px = src[i];
+        uint32_t val = 0;
+        for (size_t c = 0; c < 3; ++c) {
+            uint32_t ch = (px >> (16 - c * 8)) & 0xff;
+            ch = bits[c] <= 8 ? ch >> (8 - bits[c]) : ch << (bits[c] - 8);
+            val |= ch << shift[c];
+        }
+        for (size_t b = 0; b < bytes; ++b) {
+            const size_t pos = fmt.msb_first ? bytes - 1 - b : b;
+            dst[pos] = static_cast<uint8_t>(val >> (b * 8));
+        }
+        dst += bytes;
+    }
+}
+
+pixel_convert_fn pixel_converter(const pixel_format& fmt)
+{
+    if (fmt.native()) {
+        return nullptr;
+    }
+
+    const bool swap = fmt.msb_first != host_msb_first;
+    if (fmt.bpp == 32 && fmt.green_mask == 0x00ff00) {
+        if (fmt.red_mask == 0xff0000 && fmt.blue_mask == 0x0000ff && swap) {
+            return &convert_swap32;
+        }
+        if (fmt.red_mask == 0x0000ff && fmt.blue_mask == 0xff0000 && !swap) {
+            return &convert_rgbx32;
+        }
+    }
+    if (fmt.bpp == 16 && fmt.red_mask == 0xf800 && fmt.green_mask == 0x07e0 &&
+        fmt.blue_mask == 0x001f) {
+        return swap ? &convert_rgb565<true> : &convert_rgb565<false>;
+    }
+    return &convert_generic;
+}
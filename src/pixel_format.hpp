@@ -0,0 +1,52 @@
+// SPDX-License-Identifier: Apache-2.0
+// Copyright (C) 2020 Artem Senichev <artemsen@gmail.com>
+
+#pragma once
+
+#include "image.hpp"
+
+#include <cstddef>
+#include <cstdint>
+
+/**
+ * @struct pixel_format
+ * @brief Layout of pixels in memory expected by the X server.
+ */
+struct pixel_format {
+    /** @brief Bits per pixel (8, 16, 24 or 32). */
+    size_t bpp = 32;
+    /** @brief Byte order of the pixel, true for big-endian. */
+    bool msb_first = false;
+    /** @brief Channel masks. */
+    uint32_t red_mask = 0xff0000;
+    uint32_t green_mask = 0x00ff00;
+    uint32_t blue_mask = 0x0000ff;
+
+    /**
+     * @brief Check if the format is equal to the image::rgba_t layout,
+     *        so the pixels can be sent as is.
+     *
+     * @return true if conversion is not required
+     */
+    bool native() const;
+};
+
+/**
+ * @brief Pixel conversion kernel.
+ *
+ * @param[in] fmt destination pixel format
+ * @param[in] src source pixels
+ * @param[out] dst destination buffer
+ * @param[in] count number of pixels to convert
+ */
+using pixel_convert_fn = void (*)(const pixel_format& fmt, const image::rgba_t* src,
+                                  uint8_t* dst, size_t count);
+
+/**
+ * @brief Get the conversion kernel specialized for the pixel format.
+ *
+ * @param[in] fmt destination pixel format
+ *
+ * @return conversion kernel, nullptr if the format is native
+ */
+pixel_convert_fn pixel_converter(const pixel_format& fmt);
@@ -0,0 +1,296 @@
+// SPDX-License-Identifier: Apache-2.0
+// Copyright (C) 2020 Artem Senichev <artemsen@gmail.com>
+
+#include "preview_cache.hpp"
+#include "file_data.hpp"
+#include "image_scale.hpp"
+
+#include <algorithm>
+#include <climits>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <dirent.h>
+#include <exception>
+#include <fcntl.h>
+#include <string>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <vector>
+
+/** @brief Signature of the preview file. */
+static const char preview_sig[8] = { 'P', 'T', 'P', 'R', 'E', 'V', '0', '2' };
+/** @brief Length of the preview file name (hex hash of the key). */
+constexpr size_t name_len = 16;
+/** @brief Max total size of the previews, least recently used are removed. */
+constexpr off_t max_cache_size = 256 * 1024 * 1024;
+
+/**
+ * @struct preview_header
+ * @brief Header of the preview file, followed by the key string and BGRA
+ *        pixels of the preview.
+ */
+struct preview_header {
+    char sig[sizeof(preview_sig)];
+    uint32_t width;
+    uint32_t height;
+    uint32_t full_width;
+    uint32_t full_height;
+    uint32_t transparent;
+    uint32_t animated;
+    uint32_t key_size;
+};
+
+/**
+ * @brief Get path to the cache directory.
+ *
+ * @return path to the directory, empty string if it can't be determined
+ */
+static std::string cache_dir()
+{
+    std::string dir;
+    const char* xdg = getenv("XDG_CACHE_HOME");
+    if (xdg && *xdg) {
+        dir = xdg;
+    } else {
+        const char* home = getenv("HOME");
+        if (!home || !*home) {
+            return dir;
+        }
+        dir = home;
+        dir += "/.cache";
+    }
+    dir += "/picterm";
+    return dir;
+}
+
+/**
+ * @brief Get cache key of the file.
+ *
+ * @param[in] file path to the image file
+ * @param[out] key unique key of the file state
+ * @param[out] name name of the preview file in the cache directory
+ *
+ * @return false if file can't be cached
+ */
+static bool cache_key(const char* file, std::string& key, std::string& name)
+{
+    char path[PATH_MAX];
+    struct stat st;
+    if (!realpath(file, path) || stat(path, &st) == -1 || !S_ISREG(st.st_mode)) {
+        return false;
+    }
+
+    key = path;
+    key += ':';
+    key += std::to_string(st.st_mtim.tv_sec);
+    key += '.';
+    key += std::to_string(st.st_mtim.tv_nsec);
+    key += ':';
+    key += std::to_string(st.st_size);
+
+    // FNV-1a hash of the key used as a file name
+    uint64_t hash = 0xcbf29ce484222325;
+    for (const char ch : key) {
+        hash ^= static_cast<uint8_t>(ch);
+        hash *= 0x100000001b3;
+    }
+    char hex[name_len + 1];
+    snprintf(hex, sizeof(hex), "%016llx", static_cast<unsigned long long>(hash));
+    name = hex;
+
+    return true;
+}
+
+/**
+ * @brief Remove least recently used previews to fit the cache size limit.
+ *
+ * @param[in] dir path to the cache directory
+ */
+static void cache_cleanup(const std::string& dir)
+{
+    struct entry {
+        std::string path;
+        timespec atime;
+        off_t size;
+    };
+    std::vector<entry> entries;
+    off_t total = 0;
+
+    DIR* dd = opendir(dir.c_str());
+    if (!dd) {
+        return;
+    }
+    while (const dirent* de = readdir(dd)) {
+        if (strlen(de->d_name) != name_len) {
+            continue; // not a preview (dots, temporary files)
+        }
+        entry e;
+        e.path = dir + '/' + de->d_name;
+        struct stat st;
+        if (stat(e.path.c_str(), &st) == 0 && S_ISREG(st.st_mode)) {
+            e.atime = st.st_atim;
+            e.size = st.st_size;
+            total += e.size;
+            entries.push_back(std::move(e));
+        }
+    }
+    closedir(dd);
+
+    if (total <= max_cache_size) {
+        return;
+    }
+    std::sort(entries.begin(), entries.end(), [](const entry& a, const entry& b) {
+        return a.atime.tv_sec < b.atime.tv_sec ||
+            (a.atime.tv_sec == b.atime.tv_sec && a.atime.tv_nsec < b.atime.tv_nsec);
+    });
+    for (const entry& e : entries) {
+        if (total <= max_cache_size) {
+            break;
+        }
+        if (unlink(e.path.c_str()) == 0) {
+            total -= e.size;
+        }
+    }
+}
+
+/**
+ * @brief Get size of the image scaled to fit the area.
+ *
+ * @param[in] img image to fit
+ * @param[in] fit_w width of the area
+ * @param[in] fit_h height of the area
+ * @param[out] w width of the scaled image
+ * @param[out] h height of the scaled image
+ */
+static void fit_size(const image& img, size_t fit_w, size_t fit_h, size_t& w, size_t& h)
+{
+    w = fit_w;
+    h = fit_h;
+    if (img.full_width * fit_h > img.full_height * fit_w) {
+        h = img.full_height * fit_w / img.full_width;
+    } else {
+        w = img.full_width * fit_h / img.full_height;
+    }
+}
+
+bool preview_load(const char* file, size_t fit_w, size_t fit_h, image& img)
+{
+    std::string key, name;
+    const std::string dir = cache_dir();
+    if (dir.empty() || !cache_key(file, key, name)) {
+        return false;
+    }
+
+    const std::string path = dir + '/' + name;
+    if (access(path.c_str(), R_OK) != 0) {
+        return false;
+    }
+
+    try {
+        const file_data fd(path.c_str());
+
+        preview_header hdr;
+        if (fd.size() < sizeof(hdr)) {
+            return false;
+        }
+        memcpy(&hdr, fd.data(), sizeof(hdr));
+        const size_t pixels = static_cast<size_t>(hdr.width) * hdr.height;
+        if (memcmp(hdr.sig, preview_sig, sizeof(preview_sig)) != 0 ||
+            !hdr.width || !hdr.height || !hdr.full_width || !hdr.full_height ||
+            fd.size() != sizeof(hdr) + hdr.key_size + pixels * sizeof(image::rgba_t) ||
+            key.compare(0, std::string::npos,
+                        reinterpret_cast<const char*>(fd.data() + sizeof(hdr)),
+                        hdr.key_size) != 0) {
+            return false; // invalid or hash collision
+        }
+
+        image preview;
+        preview.width = hdr.width;
+        preview.height = hdr.height;
+        preview.full_width = hdr.full_width;
+        preview.full_height = hdr.full_height;
+        preview.transparent = hdr.transparent;
+        preview.animated = hdr.animated;
+
+        // check the preview still can fill the area
+        size_t w, h;
+        fit_size(preview, fit_w, fit_h, w, h);
+        if (preview.width < w || preview.height < h) {
+            return false;
+        }
+
+        preview.data.resize(pixels);
+        memcpy(preview.data.data(), fd.data() + sizeof(hdr) + hdr.key_size,
+               pixels * sizeof(image::rgba_t));
+        img = std::move(preview);
+    } catch (const std::exception&) {
+        return false;
+    }
+
+    // mark as recently used, atime is not updated on relatime/noatime mounts
+    const timespec times[2] = { { 0, UTIME_NOW }, { 0, UTIME_OMIT } };
+    utimensat(AT_FDCWD, path.c_str(), times, 0);
+
+    return true;
+}
+
+void preview_save(const char* file, const image& img, size_t fit_w, size_t fit_h)
+{
+    if (!img.full_width || !img.full_height) {
+        return;
+    }
+    size_t w, h;
+    fit_size(img, fit_w, fit_h, w, h);
+    if (!w || !h || (w >= img.width && h >= img.height)) {
+        return; // image is small enough
+    }
+
+    std::string key, name;
+    std::string dir = cache_dir();
+    if (dir.empty() || !cache_key(file, key, name)) {
+        return;
+    }
+
+    // create cache directory
+    const size_t parent = dir.rfind('/');
+    if (parent != std::string::npos && parent) {
+        mkdir(dir.substr(0, parent).c_str(), 0700);
+    }
+    mkdir(dir.c_str(), 0700);
+
+    image preview;
+    preview.width = w;
+    preview.height = h;
+    preview.data.resize(w * h);
+    scale_image(img, preview.data.data(), w, w, h, 0, 0, w, h, scale_filter::area);
+    preview.transparent = img.transparent && preview.has_transparency();
+
+    preview_header hdr;
+    memcpy(hdr.sig, preview_sig, sizeof(preview_sig));
+    hdr.width = w;
+    hdr.height = h;
+    hdr.full_width = img.full_width;
+    hdr.full_height = img.full_height;
+    hdr.transparent = preview.transparent;
+    hdr.animated = img.animated;
+    hdr.key_size = key.size();
+
+    // write to temporary file and rename it to make the operation atomic
+    const std::string path = dir + '/' + name;
+    const std::string tmp = path + '.' + std::to_string(getpid());
+    FILE* fd = fopen(tmp.c_str(), "wb");
+    if (!fd) {
+        return;
+    }
+    const bool ok = fwrite(&hdr, sizeof(hdr), 1, fd) == 1 &&
+                    fwrite(key.data(), key.size(), 1, fd) == 1 &&
+                    fwrite(preview.data.data(), preview.data.size() * sizeof(image::rgba_t), 1, fd) == 1;
+    if (fclose(fd) == 0 && ok) {
+        rename(tmp.c_str(), path.c_str());
+        cache_cleanup(dir);
+    } else {
+        unlink(tmp.c_str());
+    }
+}
@@ -0,0 +1,37 @@
+// SPDX-License-Identifier: Apache-2.0
+// Copyright (C) 2020 Artem Senichev <artemsen@gmail.com>
+
+#pragma once
+
+#include "image.hpp"
+
+/**
+ * @brief Load image preview from the disk cache.
+ *
+ * Previews are stored in $XDG_CACHE_HOME/picterm (~/.cache/picterm by
+ * default) and keyed by the real path, modification time and size of the
+ * file, any change of the file invalidates its preview. Least recently used
+ * previews are removed when the total size of the cache exceeds the limit.
+ *
+ * @param[in] file path to the image file
+ * @param[in] fit_w width of the area to fit the image in
+ * @param[in] fit_h height of the area to fit the image in
+ * @param[out] img image to load preview into, image::full_width/full_height
+ *                 are set to the size of the original image
+ *
+ * @return false if there is no cached preview or its resolution is not
+ *         enough to fill the area
+ */
+bool preview_load(const char* file, size_t fit_w, size_t fit_h, image& img);
+
+/**
+ * @brief Save image preview to the disk cache.
+ *
+ * Nothing is saved if the image fits the area, errors are ignored.
+ *
+ * @param[in] file path to the image file
+ * @param[in] img decoded image
+ * @param[in] fit_w width of the area to fit the preview in
+ * @param[in] fit_h height of the area to fit the preview in
+ */
+void preview_save(const char* file, const image& img, size_t fit_w, size_t fit_h);
@@ -0,0 +1,121 @@
+// SPDX-License-Identifier: Apache-2.0
+// Copyright (C) 2020 Artem Senichev <artemsen@gmail.com>
+
+#include "stats.hpp"
+
+#ifdef ENABLE_STATS
+
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <mutex>
+#include <vector>
+
+/** @brief Number of recent samples kept for each stage. */
+constexpr size_t stats_samples = 1024;
+/** @brief Number of histogram buckets (powers of 2 in microseconds). */
+constexpr size_t stats_buckets = 24;
+/** @brief Number of stages. */
+constexpr size_t stats_count = static_cast<size_t>(stats_stage::frame) + 1;
+
+/** @brief Stage names. */
+static const char* const stats_names[stats_count] = {
+    "decode", "refresh", "render", "convert", "put", "frame",
+};
+
+/** @brief Statistics of the single stage. */
+struct stage_stats {
+    /** @brief Ring buffer of recent samples (microseconds). */
+    std::vector<size_t> samples;
+    /** @brief Next position in the ring buffer. */
+    size_t pos = 0;
+    /** @brief Time accumulated since the last frame (microseconds). */
+    size_t pending = 0;
+};
+
+/** @brief Flag indicated that statistics are collected. */
+static std::atomic<bool> enabled(false);
+/** @brief Statistics of all stages. */
+static stage_stats stages[stats_count];
+/** @brief Stats access lock (decoders run in their own threads). */
+static std::mutex mutex;
+
+void stats_enable()
+{
+    enabled = true;
+}
+
+void stats_add(stats_stage stage, std::chrono::steady_clock::duration time)
+{
+    if (!enabled) {
+        return;
+    }
+    const size_t us = std::chrono::duration_cast<std::chrono::microseconds>(time).count();
+    std::lock_guard<std::mutex> lock(mutex);
+    stage_stats& st = stages[static_cast<size_t>(stage)];
+    if (st.samples.size() < stats_samples) {
+        st.samples.push_back(us);
+    } else {
+        st.samples[st.pos] = us;
+    }
+    st.pos = (st.pos + 1) % stats_samples;
+    st.pending += us;
+}
+
+void stats_frame()
+{
+    if (!enabled) {
+        return;
+    }
+    std::lock_guard<std::mutex> lock(mutex);
+    stage_stats& frame = stages[static_cast<size_t>(stats_stage::frame)];
+    const size_t total = frame.pending;
+    frame.pending = 0;
+    if (total == 0) {
+        return; // nothing was drawn
+    }
+    fprintf(stderr, "frame %.2f ms:", total / 1000.0);
+    for (size_t i = 0; i < stats_count - 1; ++i) {
+        if (stages[i].pending) {
+            fprintf(stderr, " %s %.2f", stats_names[i], stages[i].pending / 1000.0);
+            stages[i].pending = 0;
+        }
+    }
+    fputc('\n', stderr);
+}
+
+void stats_dump()
+{
+    if (!enabled) {
+        return;
+    }
+    std::lock_guard<std::mutex> lock(mutex);
+    fprintf(stderr, "%-8s %6s %9s %9s %9s %9s  histogram (<1us, <2us, <4us, ...)\n",
+            "stage", "count", "p50 ms", "p90 ms", "p99 ms", "max ms");
+    for (size_t i = 0; i < stats_count; ++i) {
+        std::vector<size_t> sorted = stages[i].samples;
+        if (sorted.empty()) {
+            continue;
+        }
+        std::sort(sorted.begin(), sorted.end());
+        const size_t n = sorted.size();
+        fprintf(stderr, "%-8s %6zu %9.2f %9.2f %9.2f %9.2f ", stats_names[i], n,
+                sorted[n / 2] / 1000.0, sorted[n * 9 / 10] / 1000.0,
+                sorted[n * 99 / 100] / 1000.0, sorted[n - 1] / 1000.0);
+
+        size_t hist[stats_buckets] = { 0 };
+        for (size_t us : sorted) {
+            size_t bucket = 0;
+            while (bucket < stats_buckets - 1 && us >= (static_cast<size_t>(1) << bucket)) {
+                ++bucket;
+            }
+            ++hist[bucket];
+        }
+        for (size_t b = 0; b < stats_buckets; ++b) {
+            fprintf(stderr, " %zu", hist[b]);
+        }
+        fputc('\n', stderr);
+    }
+}
+
+#endif // ENABLE_STATS
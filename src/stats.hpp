@@ -0,0 +1,77 @@
+// SPDX-License-Identifier: Apache-2.0
+// Copyright (C) 2020 Artem Senichev <artemsen@gmail.com>
+
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+
+/** @brief Instrumented stages. */
+enum class stats_stage {
+    decode,  ///< Image decoding (load_image)
+    refresh, ///< Viewer refresh: position, scale and full redraw
+    render,  ///< Scaling and background compositing into the frame
+    convert, ///< Conversion to the native pixel format
+    put,     ///< Putting pixels to the X server (XPutImage/XShmPutImage)
+    frame,   ///< Whole batch of events: from the first event to the flush
+};
+
+#ifdef ENABLE_STATS
+
+/**
+ * @brief Enable collecting of statistics, timers are no-op until called.
+ */
+void stats_enable();
+
+/**
+ * @brief Add time of the stage.
+ *
+ * @param[in] stage instrumented stage
+ * @param[in] time duration of the stage
+ */
+void stats_add(stats_stage stage, std::chrono::steady_clock::duration time);
+
+/**
+ * @brief Finish the frame: print the frame time and breakdown of the stages
+ *        executed since the previous frame to stderr.
+ */
+void stats_frame();
+
+/**
+ * @brief Print histograms of the recent samples to stderr.
+ */
+void stats_dump();
+
+/**
+ * @class stats_timer
+ * @brief Scoped timer: measures time of the stage from construction to
+ *        destruction.
+ */
+class stats_timer {
+public:
+    explicit stats_timer(stats_stage stage)
+        : stage_(stage)
+        , start_(std::chrono::steady_clock::now())
+    {
+    }
+
+    ~stats_timer() { stats_add(stage_, std::chrono::steady_clock::now() - start_); }
+
+private:
+    stats_stage stage_;
+    std::chrono::steady_clock::time_point start_;
+};
+
+#define STATS_CONCAT_(a, b) a##b
+#define STATS_CONCAT(a, b) STATS_CONCAT_(a, b)
+/** @brief Measure time of the current scope. */
+#define STATS_SCOPE(stage) stats_timer STATS_CONCAT(stats_timer_, __LINE__)(stats_stage::stage)
+/** @brief Finish the frame (see stats_frame()). */
+#define STATS_FRAME() stats_frame()
+
+#else
+
+#define STATS_SCOPE(stage)
+#define STATS_FRAME()
+
+#endif // ENABLE_STATS
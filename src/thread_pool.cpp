@@ -0,0 +1,122 @@
+// SPDX-License-Identifier: Apache-2.0
+// Copyright (C) 2020 Artem Senichev <artemsen@gmail.com>
+
+#include "thread_pool.hpp"
+
+#include <algorithm>
+#include <memory>
+
+/** @brief Minimal number of items (rows) in a single tile. */
+constexpr size_t tile_min = 16;
+/** @brief Number of tiles per thread, used for load balancing. */
+constexpr size_t tiles_per_thread = 4;
+
+/** @brief Shared pool instance. */
+static std::unique_ptr<thread_pool> shared_pool;
+
+/** @brief Flag indicated that current thread is a pool worker. */
+static thread_local bool pool_worker = false;
+
+thread_pool::thread_pool(size_t threads)
+    : next_(0)
+{
+    if (!threads) {
+        threads = std::thread::hardware_concurrency();
+    }
+    for (size_t i = 1; i < threads; ++i) {
+        workers_.emplace_back(&thread_pool::worker, this);
+    }
+}
+
+thread_pool::~thread_pool()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stop_ = true;
+    }
+    start_.notify_all();
+    for (auto& it : workers_) {
+        it.join();
+    }
+}
+
+void thread_pool::run(size_t count, const task_fn& fn)
+{
+    const size_t tile = std::max(tile_min, count / (size() * tiles_per_thread));
+
+    // run small and nested tasks in the current thread
+    if (workers_.empty() || count <= tile || pool_worker) {
+        fn(0, count);
+        return;
+    }
+
+    std::lock_guard<std::mutex> run_lock(run_mutex_);
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        task_ = &fn;
+        count_ = count;
+        tile_ = tile;
+        next_ = 0;
+        active_ = workers_.size();
+        ++generation_;
+    }
+    start_.notify_all();
+
+    process();
+
+    std::unique_lock<std::mutex> lock(mutex_);
+    done_.wait(lock, [this]() { return active_ == 0; });
+    task_ = nullptr;
+}
+
+void thread_pool::process()
+{
+    size_t begin;
+    while ((begin = next_.fetch_add(tile_)) < count_) {
+        (*task_)(begin, std::min(begin + tile_, count_));
+    }
+}
+
+void thread_pool::worker()
+{
+    pool_worker = true;
+
+    size_t generation = 0;
+    std::unique_lock<std::mutex> lock(mutex_);
+    while (true) {
+        start_.wait(lock, [this, generation]() { return stop_ || generation_ != generation; });
+        if (stop_) {
+            break;
+        }
+        generation = generation_;
+
+        lock.unlock();
+        process();
+        lock.lock();
+
+        if (--active_ == 0) {
+            done_.notify_one();
+        }
+    }
+}
+
+void thread_pool::init(size_t threads)
+{
+    if (!shared_pool) {
+        shared_pool.reset(new thread_pool(threads));
+    }
+}
+
+void thread_pool::parallel(size_t count, const task_fn& fn)
+{
+    if (shared_pool) {
+        shared_pool->run(count, fn);
+    } else {
+        fn(0, count);
+    }
+}
+
+size_t thread_pool::threads()
+{
+    return shared_pool ? shared_pool->size() : 1;
+}
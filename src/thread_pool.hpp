@@ -0,0 +1,107 @@
+// SPDX-License-Identifier: Apache-2.0
+// Copyright (C) 2020 Artem Senichev <artemsen@gmail.com>
+
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/**
+ * @class thread_pool
+ * @brief Persistent pool of worker threads used by pixel kernels.
+ */
+class thread_pool {
+public:
+    /**
+     * @brief Task handler.
+     *
+     * @param[in] begin index of the first item (row) to process
+     * @param[in] end index of the item (row) after the last one
+     */
+    using task_fn = std::function<void(size_t begin, size_t end)>;
+
+    /**
+     * @brief Constructor: start worker threads.
+     *
+     * @param[in] threads total number of threads (including the caller one),
+     *                    0 to use number of CPUs
+     */
+    explicit thread_pool(size_t threads);
+
+    ~thread_pool();
+
+    /**
+     * @brief Split task to tiles and execute them in parallel, the caller
+     *        thread is used as one of the workers.
+     *
+     * @param[in] count total number of items (rows) to process
+     * @param[in] fn task handler
+     */
+    void run(size_t count, const task_fn& fn);
+
+    /** @brief Get total number of threads. */
+    inline size_t size() const { return workers_.size() + 1; }
+
+    /**
+     * @brief Create the shared pool.
+     *
+     * @param[in] threads total number of threads, 0 to use number of CPUs
+     */
+    static void init(size_t threads);
+
+    /**
+     * @brief Execute task on the shared pool, the task is executed in the
+     *        current thread if the pool was not created.
+     *
+     * @param[in] count total number of items (rows) to process
+     * @param[in] fn task handler
+     */
+    static void parallel(size_t count, const task_fn& fn);
+
+    /** @brief Get total number of threads of the shared pool. */
+    static size_t threads();
+
+private:
+    /**
+     * @brief Process tiles of the current task until it is done.
+     */
+    void process();
+
+    /**
+     * @brief Worker thread function.
+     */
+    void worker();
+
+private:
+    /** @brief Worker threads. */
+    std::vector<std::thread> workers_;
+
+    /** @brief Lock used to serialize tasks from different threads. */
+    std::mutex run_mutex_;
+    /** @brief Lock of the task state. */
+    std::mutex mutex_;
+    /** @brief Start of the new task notification. */
+    std::condition_variable start_;
+    /** @brief Completion of the task notification. */
+    std::condition_variable done_;
+    /** @brief Stop flag for workers. */
+    bool stop_ = false;
+    /** @brief Task sequence number. */
+    size_t generation_ = 0;
+    /** @brief Number of workers still processing the current task. */
+    size_t active_ = 0;
+
+    /** @brief Current task handler. */
+    const task_fn* task_ = nullptr;
+    /** @brief Total number of items in the current task. */
+    size_t count_ = 0;
+    /** @brief Number of items in a single tile. */
+    size_t tile_ = 0;
+    /** @brief Index of the next item to process. */
+    std::atomic<size_t> next_;
+};
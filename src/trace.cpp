@@ -0,0 +1,33 @@
+// SPDX-License-Identifier: Apache-2.0
+// Copyright (C) 2020 Artem Senichev <artemsen@gmail.com>
+
+#include "trace.hpp"
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+
+/** @brief Process start time (static initialization precedes main()). */
+static const std::chrono::steady_clock::time_point start_time = std::chrono::steady_clock::now();
+/** @brief Flag indicated that tracing is enabled. */
+static std::atomic<bool> enabled(false);
+
+void trace_enable()
+{
+    enabled = true;
+}
+
+void trace(const char* event)
+{
+    if (enabled) {
+        const std::chrono::duration<double, std::milli> ms =
+            std::chrono::steady_clock::now() - start_time;
+        fprintf(stderr, "[%9.3f ms] %s\n", ms.count(), event);
+    }
+}
+
+void trace_finish()
+{
+    trace("startup complete");
+    enabled = false;
+}
@@ -0,0 +1,22 @@
+// SPDX-License-Identifier: Apache-2.0
+// Copyright (C) 2020 Artem Senichev <artemsen@gmail.com>
+
+#pragma once
+
+/**
+ * @brief Enable printing of startup events.
+ */
+void trace_enable();
+
+/**
+ * @brief Print startup event with the time since the process start to
+ *        stderr. Can be called from any thread.
+ *
+ * @param[in] event event description
+ */
+void trace(const char* event);
+
+/**
+ * @brief Stop printing: startup is complete.
+ */
+void trace_finish();
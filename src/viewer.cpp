@@ -2,9 +2,21 @@
 // Copyright (C) 2020 Artem Senichev <artemsen@gmail.com>
 
 #include "viewer.hpp"
+#include "file_data.hpp"
+#include "image_alloc.hpp"
 #include "image_ldr.hpp"
+#include "preview_cache.hpp"
+#include "stats.hpp"
+#include "thread_pool.hpp"
+#include "trace.hpp"
 #include "x11.hpp"
 
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <cstdio>
+#include <cstring>
+
 /** @brief Minimum scale (1%). */
 constexpr size_t scale_min = 1;
 /** @brief Minimum scale (1000%). */
@@ -13,80 +25,468 @@ constexpr size_t scale_max = 1000;
 constexpr size_t scale_step = 5;
 /** @brief Move step used on positioning. */
 constexpr size_t move_step = 10;
+/**
+ * @brief Max ratio between scaled image and window sizes to render the
+ * whole image, only visible part is rendered for the bigger ones.
+ */
+constexpr size_t viewport_ratio = 4;
+/** @brief Min interval between redraws while the image is being decoded. */
+constexpr std::chrono::milliseconds progress_interval(40);
+/** @brief Timeout to check again if the next animation frame is not ready (ms). */
+constexpr size_t anim_retry = 10;
+/** @brief Number of rows rendered by the worker between checks for a newer job. */
+constexpr size_t render_chunk = 32;
+
+viewer::~viewer()
+{
+    stop_loaders();
+    stop_render();
+}
 
 void viewer::show()
 {
-    img_ = load_image(file_name);
-    wnd_.create(border);
+    if (!cache_) {
+        // first call, the state is kept for the next ones
+        thread_pool::init(threads);
+        pixels_set_budget(max_memory);
+        if (max_memory && cache_size > max_memory / 2) {
+            cache_size = max_memory / 2; // keep the rest for the current image
+        }
+        cache_.reset(new image_cache(files.size() > 1 || persistent ? cache_size : 0));
+        init_scale_ = scale;
+    }
+    current_ = 0;
+    failed_ = 0;
+    forward_ = true;
+    fit_w_ = fit_h_ = 0;
+
+    const bool fit = (preview || max_memory) && !init_scale_ &&
+        files[0] != file_data::stdin_name;
 
-    if (!scale) {
-        calc_scale(scale_op::optimal);
+    // start decoding before the X connection setup if the window size is
+    // not required for it, so both are done in parallel
+    const bool early = !fit && !(disk_cache && !init_scale_);
+    if (early) {
+        open(0);
+        trace("viewer: decoding started");
     }
-    refresh();
 
-    wnd_.run([this](KeySym key) { return this->on_keypress(key); }, exit_unfocus);
+    wnd_.create(border, pixmap, xrender);
+    if (wnd_.xrender()) {
+        tile_ = grid_.tile();
+    }
+    if (filter != scale_filter::nearest) {
+        // nearest neighbor is fast enough to render on the event thread
+        render_thread_ = std::thread(&viewer::render_worker, this);
+    }
+
+    if (fit) {
+        // decode at reduced size to fit the window (stdin can't be reread
+        // to get the full size image), with the memory budget the full
+        // size image is loaded only if it is required and fits the budget
+        wnd_.updateWindowAttributes(border);
+        fit_w_ = wnd_.width();
+        fit_h_ = wnd_.height();
+    }
+
+    if (!early) {
+        open(0);
+        trace("viewer: decoding started");
+    }
+
+    wnd_.run([this](KeySym key) { return this->on_keypress(key); },
+             [this]() { this->on_notify(); },
+             [this]() { this->on_timer(); },
+             [this]() { this->on_flush(); }, exit_unfocus);
+
+    close();
 }
 
-void viewer::refresh()
+void viewer::close()
 {
-    // prepare image to show
-    image img;
-    if (scale != 100) {
-        img = img_.resize(scale);
-    } else {
-        img = img_; // todo
-    }
-    if (img.transparent) {
-        img = img.add_grid();
+    stop_loaders();
+    stop_render();
+    // animation player starts from the first frame, others are not cached
+    const bool cacheable = !anim_ || img_.animated;
+    anim_.reset();
+
+    // keep the complete image to show it instantly next time
+    if (complete_ && cacheable && cache_) {
+        cache_->put(current_file(), std::move(img_));
     }
+    img_ = image();
+    mips_.clear();
+    uploaded_w_ = 0;
+    header_ = false;
+    complete_ = false;
+    frame_ = nullptr;
+
+    wnd_.destroy();
+}
+
+void viewer::refresh()
+{
+    STATS_SCOPE(refresh);
+    const size_t img_w = img_.full_width * scale / 100;
+    const size_t img_h = img_.full_height * scale / 100;
 
     // recalculate position of image on window
     wnd_.updateWindowAttributes(border);
-    ssize_t img_x;
-    ssize_t img_y;
     const size_t wnd_w = wnd_.width();
     const size_t wnd_h = wnd_.height();
 
-    if (img.width < wnd_w) {
+    if (img_w < wnd_w) {
         // width size fits into window
-        img_x = wnd_w / 2 - img.width / 2;
+        img_x_ = wnd_w / 2 - img_w / 2;
     } else {
         // move to save center of previous image
-        const ssize_t delta = static_cast<ssize_t>(wnd_.img_w()) - img.width;
-        img_x = wnd_.img_x() + delta / 2;
-        if (img_x > 0) {
-            img_x = 0;
-        } else if (img_x + img.width < wnd_w) {
-            img_x = wnd_w - img.width;
+        const ssize_t delta = static_cast<ssize_t>(img_w_) - img_w;
+        img_x_ += delta / 2;
+        if (img_x_ > 0) {
+            img_x_ = 0;
+        } else if (img_x_ + img_w < wnd_w) {
+            img_x_ = wnd_w - img_w;
         }
     }
-    if (img.height < wnd_h) {
+    if (img_h < wnd_h) {
         // height size fits into window
-        img_y = wnd_h / 2 - img.height / 2;
+        img_y_ = wnd_h / 2 - img_h / 2;
     } else {
         // move to save center of previous image
-        const ssize_t delta = static_cast<ssize_t>(wnd_.img_h()) - img.height;
-        img_y = wnd_.img_y() + delta / 2;
-        if (img_y > 0) {
-            img_y = 0;
-        } else if (img_y + img.height < wnd_h) {
-            img_y = wnd_h - img.height;
+        const ssize_t delta = static_cast<ssize_t>(img_h_) - img_h;
+        img_y_ += delta / 2;
+        if (img_y_ > 0) {
+            img_y_ = 0;
+        } else if (img_y_ + img_h < wnd_h) {
+            img_y_ = wnd_h - img_h;
         }
     }
 
-    wnd_.set_image(img, img_x, img_y);
+    img_w_ = img_w;
+    img_h_ = img_h;
+    viewport_ = viewport || img_w * img_h > viewport_ratio * wnd_w * wnd_h ||
+        !pixels_fit(img_w * img_h * sizeof(image::rgba_t));
+
+    draw();
+
+    if (img_w > img_.width || img_h > img_.height) {
+        load_full();
+    }
 
-    std::string title = file_name;
+    std::string title = current_file();
     title += " [";
-    title += std::to_string(img_.width);
+    if (files.size() > 1) {
+        title += std::to_string(current_ + 1);
+        title += '/';
+        title += std::to_string(files.size());
+        title += ' ';
+    }
+    title += std::to_string(img_.full_width);
     title += 'x';
-    title += std::to_string(img_.height);
+    title += std::to_string(img_.full_height);
     title += ' ';
     title += std::to_string(scale);
-    title += "%]";
+    title += '%';
+    if (pixels_budget()) {
+        title += " mem:";
+        title += std::to_string(pixels_usage() / (1024 * 1024));
+        title += '/';
+        title += std::to_string(pixels_budget() / (1024 * 1024));
+        title += "MiB";
+    }
+    title += ']';
     wnd_.set_title(title.c_str());
 }
 
+void viewer::visible_area(size_t& x, size_t& y, size_t& w, size_t& h,
+                          ssize_t& wnd_x, ssize_t& wnd_y) const
+{
+    wnd_x = img_x_;
+    wnd_y = img_y_;
+    x = 0;
+    y = 0;
+    w = img_w_;
+    h = img_h_;
+
+    if (viewport_) {
+        // visible area of the scaled image
+        x = img_x_ < 0 ? -img_x_ : 0;
+        y = img_y_ < 0 ? -img_y_ : 0;
+        wnd_x = img_x_ > 0 ? img_x_ : 0;
+        wnd_y = img_y_ > 0 ? img_y_ : 0;
+        w = std::min(img_w_ - x, wnd_.width() - wnd_x);
+        h = std::min(img_h_ - y, wnd_.height() - wnd_y);
+    }
+}
+
+void viewer::draw()
+{
+    cancel_render();
+    if (draw_xrender() || draw_async()) {
+        return;
+    }
+
+    size_t x, y, w, h;
+    ssize_t wnd_x, wnd_y;
+    visible_area(x, y, w, h, wnd_x, wnd_y);
+
+    // render directly into the window's frame buffer
+    frame_ = wnd_.frame(w, h);
+    frame_x_ = x;
+    frame_y_ = y;
+    frame_w_ = w;
+    frame_h_ = h;
+    frame_rows_ = 0;
+    render_rows();
+    if (frame_rows_ < frame_h_) {
+        // not decoded yet
+        memset(frame_ + frame_rows_ * w, 0, (h - frame_rows_) * w * sizeof(image::rgba_t));
+    }
+    wnd_.set_frame(wnd_x, wnd_y);
+}
+
+bool viewer::draw_xrender()
+{
+    if (!complete_ || !wnd_.xrender()) {
+        return false; // partially decoded image is drawn row by row
+    }
+
+    // the server scales the pyramid level nearest to the target size,
+    // so the source is uploaded only when the image or the level changes
+    const image& src = source(img_w_, img_h_);
+    if (src.width != uploaded_w_) {
+        uploaded_ = wnd_.set_source(src, img_.transparent ? &tile_ : nullptr);
+        uploaded_w_ = src.width;
+    }
+    if (!uploaded_) {
+        return false;
+    }
+
+    frame_ = nullptr;
+    wnd_.render(img_x_, img_y_, img_w_, img_h_, filter != scale_filter::nearest);
+    return true;
+}
+
+bool viewer::draw_async()
+{
+    if (!complete_ || !render_thread_.joinable()) {
+        return false;
+    }
+
+    size_t x, y, w, h;
+    ssize_t wnd_x, wnd_y;
+    visible_area(x, y, w, h, wnd_x, wnd_y);
+    const image& src = source(img_w_, img_h_);
+    const grid* bkg = img_.transparent ? &grid_ : nullptr;
+
+    // show the fast preview immediately
+    frame_ = wnd_.frame(w, h);
+    frame_x_ = x;
+    frame_y_ = y;
+    frame_w_ = w;
+    frame_h_ = h;
+    frame_rows_ = h;
+    {
+        STATS_SCOPE(render);
+        scale_image(src, frame_, w, img_w_, img_h_, x, y, w, h, scale_filter::nearest, bkg);
+    }
+    wnd_.set_frame(wnd_x, wnd_y);
+
+    {
+        std::lock_guard<std::mutex> lock(render_mutex_);
+        render_job_ = render_job { &src, img_w_, img_h_, x, y, w, h, bkg };
+        render_pending_ = true;
+        render_ready_ = false;
+        ++render_seq_;
+    }
+    render_cond_.notify_all();
+    return true;
+}
+
+void viewer::stop_render()
+{
+    if (render_thread_.joinable()) {
+        {
+            std::lock_guard<std::mutex> lock(render_mutex_);
+            render_stop_ = true;
+            ++render_seq_;
+        }
+        render_cond_.notify_all();
+        render_thread_.join();
+        render_stop_ = false;
+        render_pending_ = false;
+        render_ready_ = false;
+    }
+}
+
+void viewer::cancel_render()
+{
+    if (!render_thread_.joinable()) {
+        return;
+    }
+    std::unique_lock<std::mutex> lock(render_mutex_);
+    ++render_seq_;
+    render_pending_ = false;
+    render_ready_ = false;
+    render_cond_.wait(lock, [this]() { return !render_busy_; });
+}
+
+void viewer::apply_render()
+{
+    std::lock_guard<std::mutex> lock(render_mutex_);
+    if (!render_ready_) {
+        return;
+    }
+    render_ready_ = false;
+    if (frame_ && render_buf_.size() == frame_w_ * frame_h_) {
+        wnd_.wait_frame();
+        memcpy(frame_, render_buf_.data(), render_buf_.size() * sizeof(image::rgba_t));
+        wnd_.update_frame(0, frame_h_);
+    }
+}
+
+void viewer::render_worker()
+{
+    std::unique_lock<std::mutex> lock(render_mutex_);
+    while (!render_stop_) {
+        if (!render_pending_) {
+            render_cond_.wait(lock);
+            continue;
+        }
+        const render_job job = render_job_;
+        const size_t seq = render_seq_;
+        render_pending_ = false;
+        render_busy_ = true;
+        lock.unlock();
+
+        // render by chunks to abort as soon as the job becomes stale
+        render_buf_.resize(job.w * job.h);
+        size_t row = 0;
+        while (row < job.h && seq == render_seq_) {
+            STATS_SCOPE(render);
+            const size_t rows = std::min(render_chunk, job.h - row);
+            scale_image(*job.src, render_buf_.data() + row * job.w, job.w,
+                        job.scaled_w, job.scaled_h, job.x, job.y + row, job.w, rows,
+                        filter, job.bkg);
+            row += rows;
+        }
+
+        lock.lock();
+        render_busy_ = false;
+        if (row == job.h && seq == render_seq_) {
+            render_ready_ = true;
+            wnd_.notify();
+        }
+        render_cond_.notify_all();
+    }
+}
+
+void viewer::scroll()
+{
+    size_t x, y, w, h;
+    ssize_t wnd_x, wnd_y;
+    visible_area(x, y, w, h, wnd_x, wnd_y);
+
+    // shift of the frame content
+    const ssize_t dx = static_cast<ssize_t>(frame_x_) - static_cast<ssize_t>(x);
+    const ssize_t dy = static_cast<ssize_t>(frame_y_) - static_cast<ssize_t>(y);
+    const size_t adx = std::abs(dx);
+    const size_t ady = std::abs(dy);
+
+    bool rendering;
+    {
+        std::lock_guard<std::mutex> lock(render_mutex_);
+        rendering = render_pending_ || render_busy_ || render_ready_;
+    }
+
+    if (rendering || !complete_ || !frame_ || w != frame_w_ || h != frame_h_ ||
+        wnd_x != wnd_.img_x() || wnd_y != wnd_.img_y() || adx >= w || ady >= h) {
+        draw(); // frame can't be reused
+        return;
+    }
+    if (!dx && !dy) {
+        return;
+    }
+
+    // move pixels that stay visible
+    wnd_.wait_frame(); // the frame can still be read by the server
+    const size_t row_sz = (w - adx) * sizeof(image::rgba_t);
+    const size_t src_x = dx < 0 ? adx : 0;
+    const size_t dst_x = dx > 0 ? adx : 0;
+    if (dy > 0) {
+        for (size_t row = h - 1; row >= ady; --row) {
+            memmove(frame_ + row * w + dst_x, frame_ + (row - ady) * w + src_x, row_sz);
+        }
+    } else {
+        for (size_t row = 0; row < h - ady; ++row) {
+            memmove(frame_ + row * w + dst_x, frame_ + (row + ady) * w + src_x, row_sz);
+        }
+    }
+
+    frame_x_ = x;
+    frame_y_ = y;
+
+    // render newly exposed strips
+    STATS_SCOPE(render);
+    const image& src = source(img_w_, img_h_);
+    const grid* bkg = img_.transparent ? &grid_ : nullptr;
+    const size_t rows_y = dy > 0 ? 0 : h - ady;
+    if (ady) {
+        scale_image(src, frame_ + rows_y * w, w, img_w_, img_h_,
+                    x, y + rows_y, w, ady, filter, bkg);
+    }
+    if (adx) {
+        const size_t cols_x = dx > 0 ? 0 : w - adx;
+        const size_t first = dy > 0 ? ady : 0;
+        scale_image(src, frame_ + first * w + cols_x, w, img_w_, img_h_,
+                    x + cols_x, y + first, adx, h - ady, filter, bkg);
+    }
+
+    wnd_.scroll_frame(dx, dy);
+}
+
+void viewer::render_rows()
+{
+    size_t rows = frame_h_;
+    if (!complete_) {
+        // rows of the scaled image covered by decoded part (with a margin for filters)
+        const size_t covered = ready_ > 2 ? (ready_ - 2) * img_h_ / img_.height : 0;
+        rows = covered > frame_y_ ? std::min(covered - frame_y_, frame_h_) : 0;
+    }
+    if (rows > frame_rows_) {
+        STATS_SCOPE(render);
+        wnd_.wait_frame();
+        scale_image(source(img_w_, img_h_), frame_ + frame_rows_ * frame_w_, frame_w_,
+                    img_w_, img_h_, frame_x_, frame_y_ + frame_rows_,
+                    frame_w_, rows - frame_rows_,
+                    filter, img_.transparent ? &grid_ : nullptr);
+        frame_rows_ = rows;
+    }
+}
+
+const image& viewer::source(size_t w, size_t h)
+{
+    const image* src = &img_;
+    if (!complete_) {
+        return *src; // pyramid can be built only from the complete image
+    }
+    for (size_t i = 0;; ++i) {
+        if (src->width / 2 < w || src->height / 2 < h || src->width < 2 || src->height < 2) {
+            break;
+        }
+        if (i == mips_.size()) {
+            // build the next level lazily, use the larger one if it doesn't
+            // fit the memory budget
+            if (!reserve((src->width / 2) * (src->height / 2) * sizeof(image::rgba_t))) {
+                break;
+            }
+            mips_.push_back(src->downsample());
+        }
+        src = &mips_[i];
+    }
+    return *src;
+}
+
 bool viewer::calc_scale(scale_op op)
 {
     const size_t old_scale = scale;
@@ -115,11 +515,11 @@ bool viewer::calc_scale(scale_op op)
         // 100% or less to fit the window
         wnd_.updateWindowAttributes(border);
         scale = 100;
-        if (wnd_.width() < img_.width) {
-            scale = 100 * (1.0f / (static_cast<float>(img_.width) / wnd_.width()));
+        if (wnd_.width() < img_.full_width) {
+            scale = 100 * (1.0f / (static_cast<float>(img_.full_width) / wnd_.width()));
         }
-        if (wnd_.height() < img_.height) {
-            const size_t min_scale = 100 * (1.0f / (static_cast<float>(img_.height) / wnd_.height()));
+        if (wnd_.height() < img_.full_height) {
+            const size_t min_scale = 100 * (1.0f / (static_cast<float>(img_.full_height) / wnd_.height()));
             if (min_scale < scale) {
                 scale = min_scale;
             }
@@ -132,28 +532,32 @@ bool viewer::calc_scale(scale_op op)
 
 void viewer::change_scale(scale_op op)
 {
-    if (calc_scale(op)) {
-        refresh();
+    if (header_ && calc_scale(op)) {
+        need_refresh_ = true;
     }
 }
 
 void viewer::change_scale(size_t sc)
 {
-    if (scale != sc) {
+    if (header_ && scale != sc) {
         scale = sc;
-        refresh();
+        need_refresh_ = true;
     }
 }
 
 void viewer::change_position(move_op mv)
 {
+    if (!header_) {
+        return;
+    }
+
     wnd_.updateWindowAttributes(border);
     const size_t wnd_w = wnd_.width();
     const size_t wnd_h = wnd_.height();
-    const size_t img_w = wnd_.img_w();
-    const size_t img_h = wnd_.img_h();
-    ssize_t img_x = wnd_.img_x();
-    ssize_t img_y = wnd_.img_y();
+    const size_t img_w = img_w_;
+    const size_t img_h = img_h_;
+    ssize_t img_x = img_x_;
+    ssize_t img_y = img_y_;
 
     if (img_x > 0 && img_x + img_w < wnd_w && img_y > 0 && img_y + img_h < wnd_h) {
         return; // the whole image inside the window
@@ -194,8 +598,318 @@ void viewer::change_position(move_op mv)
         break;
     }
 
-    if (img_x != wnd_.img_x() || img_y != wnd_.img_y()) {
-        wnd_.move_image(img_x, img_y);
+    if (img_x != img_x_ || img_y != img_y_) {
+        img_x_ = img_x;
+        img_y_ = img_y;
+        if (viewport_) {
+            need_draw_ = true;
+        } else {
+            wnd_.move_image(img_x, img_y);
+        }
+    }
+}
+
+void viewer::on_flush()
+{
+    if (need_refresh_) {
+        refresh();
+    } else if (need_draw_) {
+        scroll();
+    }
+    need_refresh_ = false;
+    need_draw_ = false;
+}
+
+void viewer::on_timer()
+{
+    if (!anim_) {
+        return;
+    }
+
+    // frames are taken only by this thread, so a ready frame can't be
+    // lost before next() and the decision is made once
+    if (!anim_->ready()) {
+        if (anim_->finished()) {
+            anim_.reset(); // single frame, nothing to play
+        } else {
+            wnd_.set_timer(anim_retry);
+        }
+        return;
+    }
+
+    // the current frame buffer is returned to the player, stop the
+    // worker that may read it (or its pyramid levels)
+    cancel_render();
+    size_t delay;
+    anim_->next(img_, delay);
+    mips_.clear();
+    uploaded_w_ = 0;
+    draw();
+    wnd_.set_timer(delay);
+}
+
+void viewer::open(size_t index)
+{
+    stop_loaders();
+    cancel_render();
+    // animation player starts from the first frame, others are not cached
+    const bool cacheable = !anim_ || img_.animated;
+    anim_.reset();
+    wnd_.stop_timer();
+
+    // keep the complete image to switch back to it instantly
+    if (complete_ && cacheable) {
+        cache_->put(current_file(), std::move(img_));
+    }
+
+    current_ = index;
+    img_ = image();
+    mips_.clear();
+    uploaded_w_ = 0;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        decoded_header_ = false;
+        decoded_rows_ = 0;
+        decoded_ = false;
+        decoded_transparent_ = false;
+        error_ = nullptr;
+        full_ = image();
+        full_ready_ = false;
+    }
+    header_ = false;
+    ready_ = 0;
+    complete_ = false;
+    scale = init_scale_;
+    img_x_ = img_y_ = 0;
+    img_w_ = img_h_ = 0;
+    need_refresh_ = need_draw_ = false;
+
+    bool cached = cache_->take(current_file(), img_);
+
+    // use preview from the disk cache to show the image at optimal scale,
+    // the full image is decoded only if the scale requires it
+    preview_w_ = preview_h_ = 0;
+    if (!cached && disk_cache && !init_scale_ && current_file() != file_data::stdin_name) {
+        wnd_.updateWindowAttributes(border);
+        cached = preview_load(current_file().c_str(), wnd_.width(), wnd_.height(), img_);
+        if (!cached) {
+            preview_w_ = wnd_.width();
+            preview_h_ = wnd_.height();
+        }
+    }
+
+    if (cached) {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            decoded_header_ = true;
+            decoded_rows_ = img_.height;
+            decoded_ = true;
+            decoded_transparent_ = img_.transparent;
+        }
+        // handled by the event loop: the window may not be created yet
+        wnd_.notify();
+    } else {
+        loader_ = std::thread(&viewer::load, this, fit_w_, fit_h_);
+    }
+}
+
+void viewer::switch_file(bool forward)
+{
+    const size_t count = files.size();
+    if (count > 1) {
+        forward_ = forward;
+        open(forward ? (current_ + 1) % count : (current_ + count - 1) % count);
+    }
+}
+
+void viewer::stop_loaders()
+{
+    abort_ = true;
+    if (loader_.joinable()) {
+        loader_.join();
+    }
+    if (full_loader_.joinable()) {
+        full_loader_.join();
+    }
+    abort_ = false;
+}
+
+void viewer::prefetch()
+{
+    const size_t count = files.size();
+    if (count > 1) {
+        // the next file in the current direction is the most likely one
+        const size_t next = (current_ + 1) % count;
+        const size_t prev = (current_ + count - 1) % count;
+        std::vector<std::string> queue;
+        queue.push_back(files[forward_ ? next : prev]);
+        if (count > 2) {
+            queue.push_back(files[forward_ ? prev : next]);
+        }
+        cache_->prefetch(queue, fit_w_, fit_h_);
+    }
+}
+
+void viewer::load(size_t fit_w, size_t fit_h)
+{
+    using clock = std::chrono::steady_clock;
+    clock::time_point last;
+
+    try {
+        const file_data fd(current_file().c_str());
+        if (fit_w && fit_h && !preview) {
+            // reduced decoding is used only to keep the memory budget: check
+            // the size in headers to decode at full size if it fits
+            image_info info;
+            if (probe_image(fd.data(), fd.size(), info) &&
+                pixels_fit(info.width * info.height * sizeof(image::rgba_t))) {
+                fit_w = fit_h = 0;
+            }
+        }
+        load_image(fd.data(), fd.size(), img_, [this, &last](size_t rows) {
+            const clock::time_point now = clock::now();
+            if (rows == 0 || rows == img_.height || now - last >= progress_interval) {
+                last = now;
+                if (rows == 0) {
+                    trace("viewer: image header decoded");
+                }
+                {
+                    std::lock_guard<std::mutex> lock(mutex_);
+                    decoded_header_ = true;
+                    decoded_rows_ = rows;
+                }
+                wnd_.notify();
+            }
+            return !abort_;
+        }, fit_w, fit_h);
+
+        const bool transparent = img_.transparent && img_.has_transparency();
+        if (preview_w_ && preview_h_) {
+            preview_save(current_file().c_str(), img_, preview_w_, preview_h_);
+        }
+        std::lock_guard<std::mutex> lock(mutex_);
+        decoded_transparent_ = transparent;
+        decoded_ = true;
+    } catch (...) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        error_ = std::current_exception();
+    }
+    wnd_.notify();
+}
+
+void viewer::load_full()
+{
+    if (!complete_ || full_loader_.joinable() || img_.width == img_.full_width) {
+        return; // already loaded or in progress
+    }
+    if (!reserve(img_.full_width * img_.full_height * sizeof(image::rgba_t))) {
+        return; // keep using the reduced image
+    }
+
+    const std::string file = current_file();
+    full_loader_ = std::thread([this, file]() {
+        image img;
+        try {
+            load_image(file.c_str(), img, [this](size_t) { return !abort_; });
+            if (img.transparent) {
+                img.transparent = img.has_transparency();
+            }
+        } catch (const std::exception&) {
+            return; // keep using the reduced image
+        }
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            full_ = std::move(img);
+            full_ready_ = true;
+        }
+        wnd_.notify();
+    });
+}
+
+bool viewer::reserve(size_t size)
+{
+    if (pixels_fit(size)) {
+        return true;
+    }
+    cache_->trim(0);
+    return pixels_fit(size);
+}
+
+void viewer::on_notify()
+{
+    apply_render();
+
+    std::unique_lock<std::mutex> lock(mutex_);
+    if (error_) {
+        const std::exception_ptr err = error_;
+        error_ = nullptr;
+        lock.unlock();
+        if (++failed_ >= files.size()) {
+            std::rethrow_exception(err); // nothing to show
+        }
+        // skip the file
+        try {
+            std::rethrow_exception(err);
+        } catch (const std::exception& ex) {
+            fprintf(stderr, "Unable to load file %s: %s\n", current_file().c_str(), ex.what());
+        }
+        switch_file(forward_);
+        return;
+    }
+    if (!decoded_header_) {
+        return;
+    }
+    const size_t rows = decoded_rows_;
+    const bool decoded = decoded_;
+    const bool transparent = decoded_transparent_;
+    if (full_ready_) {
+        cancel_render();
+        full_ready_ = false;
+        img_ = std::move(full_);
+        mips_.clear();
+        uploaded_w_ = 0;
+    }
+    lock.unlock();
+
+    const bool first = !header_;
+    header_ = true;
+    failed_ = 0;
+
+    if (decoded && !complete_) {
+        complete_ = true;
+        ready_ = img_.height;
+        img_.transparent = transparent;
+        prefetch();
+        if (current_file() != file_data::stdin_name) {
+            anim_ = animation::create(current_file().c_str(), img_);
+            if (anim_) {
+                wnd_.set_timer(0);
+            }
+        }
+        if (!first) {
+            refresh(); // full size image may be required now
+            return;
+        }
+    } else if (rows > ready_) {
+        ready_ = rows;
+        if (!first) {
+            // draw newly decoded rows only
+            const size_t first_row = frame_rows_;
+            render_rows();
+            if (frame_rows_ > first_row) {
+                wnd_.update_frame(first_row, frame_rows_ - first_row);
+            }
+            return;
+        }
+    }
+
+    if (first) {
+        if (!scale) {
+            calc_scale(scale_op::optimal);
+        }
+        refresh();
+    } else {
+        draw();
     }
 }
 
@@ -248,6 +962,16 @@ bool viewer::on_keypress(KeySym key)
         case XK_9: change_scale(90); break;
         case XK_0: change_scale(100); break;
 
+        case XK_n:
+        case XK_space:
+        case XK_Next:
+            switch_file(true);
+            break;
+        case XK_p:
+        case XK_Prior:
+            switch_file(false);
+            break;
+
         case XK_Escape:
         case XK_Cancel:
         case XK_Return:
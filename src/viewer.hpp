@@ -3,10 +3,21 @@
 
 #pragma once
 
+#include "animation.hpp"
 #include "image.hpp"
+#include "image_cache.hpp"
+#include "image_scale.hpp"
 #include "x11.hpp"
 
+#include <atomic>
+#include <condition_variable>
 #include <cstddef>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
 
 /**
  * @class viewer
@@ -14,6 +25,8 @@
  */
 class viewer {
 public:
+    ~viewer();
+
     /**
      * @brief Show image.
      *
@@ -21,12 +34,111 @@ public:
      */
     void show();
 
+    /**
+     * @brief Close the window and stop background tasks, the X connection
+     *        and caches are kept for the next show() call.
+     */
+    void close();
+
+    /**
+     * @brief Get path to the currently shown file.
+     *
+     * @return path to the file
+     */
+    const std::string& current_file() const { return files[current_]; }
+
+    /**
+     * @brief Set file descriptor to watch: the window is closed as soon as
+     *        the descriptor becomes readable or closed.
+     *
+     * @param[in] fd file descriptor, -1 to stop watching
+     */
+    void watch(int fd) { wnd_.watch(fd); }
+
 private:
     /**
      * @brief Refresh image on the window.
      */
     void refresh();
 
+    /**
+     * @brief Get area of the scaled image to render.
+     *
+     * @param[out] x left coordinate of the area on the scaled image
+     * @param[out] y top coordinate of the area on the scaled image
+     * @param[out] w width of the area
+     * @param[out] h height of the area
+     * @param[out] wnd_x X coordinate of the area on the window
+     * @param[out] wnd_y Y coordinate of the area on the window
+     */
+    void visible_area(size_t& x, size_t& y, size_t& w, size_t& h,
+                      ssize_t& wnd_x, ssize_t& wnd_y) const;
+
+    /**
+     * @brief Render image and put it on the window.
+     */
+    void draw();
+
+    /**
+     * @brief Draw the complete image scaled with XRender.
+     *
+     * @return false if XRender can't be used
+     */
+    bool draw_xrender();
+
+    /**
+     * @brief Draw the complete image: the frame is rendered at once with
+     *        the fast nearest neighbor filter and the precise one is
+     *        rendered by the worker thread in background.
+     *
+     * @return false if the frame must be rendered synchronously
+     */
+    bool draw_async();
+
+    /**
+     * @brief Cancel the current render job and wait for the worker, must be
+     *        called before changing the image or its pyramid.
+     */
+    void cancel_render();
+
+    /**
+     * @brief Stop the render worker thread.
+     */
+    void stop_render();
+
+    /**
+     * @brief Put the frame rendered by the worker to the window.
+     */
+    void apply_render();
+
+    /**
+     * @brief Render worker thread function.
+     */
+    void render_worker();
+
+    /**
+     * @brief Update the frame after the view point was moved in viewport
+     *        mode: reuse visible pixels and render only the exposed strips.
+     */
+    void scroll();
+
+    /**
+     * @brief Render frame rows that are covered by the decoded part of
+     *        the image and have not been rendered yet.
+     */
+    void render_rows();
+
+    /**
+     * @brief Get source image to render the scaled one: the smallest level
+     *        of the pyramid that is not less than the scaled image.
+     *
+     * @param[in] w width of the scaled image
+     * @param[in] h height of the scaled image
+     *
+     * @return source image
+     */
+    const image& source(size_t w, size_t h);
+
     /** @brief Scale operation types. */
     enum class scale_op {
         zoom_in,
@@ -77,19 +189,228 @@ private:
      */
     bool on_keypress(KeySym key);
 
+    /**
+     * @brief Notification handler (see x11::notify_fn).
+     */
+    void on_notify();
+
+    /**
+     * @brief End of events batch handler (see x11::flush_fn): apply the
+     *        accumulated scale and position changes.
+     */
+    void on_flush();
+
+    /**
+     * @brief Timer handler (see x11::timer_fn), used to show the next
+     *        frame of animation.
+     */
+    void on_timer();
+
+    /**
+     * @brief Open file from the list.
+     *
+     * @param[in] index index of the file in the list
+     */
+    void open(size_t index);
+
+    /**
+     * @brief Switch to the next or previous file in the list.
+     *
+     * @param[in] forward direction: true for the next file
+     */
+    void switch_file(bool forward);
+
+    /**
+     * @brief Stop background decoders of the current image.
+     */
+    void stop_loaders();
+
+    /**
+     * @brief Start prefetching of the neighbor files.
+     */
+    void prefetch();
+
+    /**
+     * @brief Decode the image (executed in a background thread).
+     *
+     * @param[in] fit_w width of the area to fit the image in, 0 for full size
+     * @param[in] fit_h height of the area to fit the image in, 0 for full size
+     */
+    void load(size_t fit_w, size_t fit_h);
+
+    /**
+     * @brief Start decoding of the full size image in background if the
+     *        current one has not enough resolution for the current scale.
+     */
+    void load_full();
+
+    /**
+     * @brief Make room for the new pixel buffer within the memory budget,
+     *        the image cache is dropped if required.
+     *
+     * @param[in] size size of the new buffer in bytes
+     *
+     * @return false if the buffer doesn't fit the budget anyway
+     */
+    bool reserve(size_t size);
+
 public:
-    /** @brief Path to the file to show. */
-    const char* file_name = nullptr;
+    /** @brief Paths to the files to show. */
+    std::vector<std::string> files;
+    /** @brief Keep the rendered frame in the server-side pixmap. */
+    bool pixmap = false;
+    /** @brief Scale the image on the server side with XRender. */
+    bool xrender = false;
+    /** @brief Use disk cache of the previews. */
+    bool disk_cache = false;
+    /** @brief Max total size of prefetched images (bytes). */
+    size_t cache_size = 256 * 1024 * 1024;
+    /** @brief Memory budget for all pixel buffers (bytes), 0 for unlimited. */
+    size_t max_memory = 0;
+    /** @brief Keep the image cache between show() calls (daemon mode). */
+    bool persistent = false;
     /** @brief Current image scale. */
     size_t scale = 0;
     /** @brief Window border size. */
     size_t border = 0;
     /** @brief Exit if window lost focus. */
     bool exit_unfocus = false;
+    /** @brief Always render only visible part of the image. */
+    bool viewport = false;
+    /** @brief Scale filter. */
+    scale_filter filter = scale_filter::nearest;
+    /** @brief Number of threads used for image processing (0 = auto). */
+    size_t threads = 0;
+    /** @brief Decode image at reduced size to fit the window if possible. */
+    bool preview = false;
 
 private:
     /** @brief X11 window. */
     x11 wnd_;
+    /** @brief Index of the currently shown file. */
+    size_t current_ = 0;
+    /** @brief Initial scale (0 = auto), applied to each opened file. */
+    size_t init_scale_ = 0;
+    /** @brief Size of the area to fit the images in (fast preview mode). */
+    size_t fit_w_ = 0;
+    size_t fit_h_ = 0;
+    /** @brief Size of the area to fit the preview to save in the disk cache. */
+    size_t preview_w_ = 0;
+    size_t preview_h_ = 0;
+    /** @brief Number of files failed to load in a row. */
+    size_t failed_ = 0;
+    /** @brief Direction of the last file switch. */
+    bool forward_ = true;
+    /** @brief Cache of the decoded images. */
+    std::unique_ptr<image_cache> cache_;
+    /** @brief Animation player, nullptr if the image is not animated. */
+    std::unique_ptr<animation> anim_;
     /** @brief Original image to show. */
     image img_;
+    /** @brief Image pyramid: downsampled levels of original image (1/2, 1/4, ...). */
+    std::vector<image> mips_;
+    /** @brief Background for transparent images. */
+    grid grid_;
+    /** @brief Background tile for transparent images drawn with XRender. */
+    image tile_;
+    /** @brief Width of the image uploaded for XRender, 0 if not uploaded. */
+    size_t uploaded_w_ = 0;
+    /** @brief Flag indicated that the uploaded image can be rendered by XRender. */
+    bool uploaded_ = false;
+
+    /** @brief X coordinate of scaled image on window (top-left corner). */
+    ssize_t img_x_ = 0;
+    /** @brief Y coordinate of scaled image on window (top-left corner). */
+    ssize_t img_y_ = 0;
+    /** @brief Width of scaled image. */
+    size_t img_w_ = 0;
+    /** @brief Height of scaled image. */
+    size_t img_h_ = 0;
+    /** @brief Flag indicated that only visible part of the image is rendered. */
+    bool viewport_ = false;
+    /** @brief Flag indicated that scale was changed by the current events batch. */
+    bool need_refresh_ = false;
+    /** @brief Flag indicated that visible area was changed by the current events batch. */
+    bool need_draw_ = false;
+
+    /** @brief Frame buffer of the window. */
+    image::rgba_t* frame_ = nullptr;
+    /** @brief X coordinate of the frame on the scaled image. */
+    size_t frame_x_ = 0;
+    /** @brief Y coordinate of the frame on the scaled image. */
+    size_t frame_y_ = 0;
+    /** @brief Width of the frame. */
+    size_t frame_w_ = 0;
+    /** @brief Height of the frame. */
+    size_t frame_h_ = 0;
+    /** @brief Number of rendered rows of the frame. */
+    size_t frame_rows_ = 0;
+
+    /** @brief Flag indicated that image size is known. */
+    bool header_ = false;
+    /** @brief Number of decoded rows that can be shown. */
+    size_t ready_ = 0;
+    /** @brief Flag indicated that the image is completely decoded. */
+    bool complete_ = false;
+
+    /** @brief Background decoder of the image. */
+    std::thread loader_;
+    /** @brief Flag used to abort background decoding. */
+    std::atomic<bool> abort_ { false };
+
+    /** @brief Lock of the state shared with background decoders. */
+    std::mutex mutex_;
+    /** @brief Shared state: image size is known. */
+    bool decoded_header_ = false;
+    /** @brief Shared state: number of decoded rows. */
+    size_t decoded_rows_ = 0;
+    /** @brief Shared state: decoding is complete. */
+    bool decoded_ = false;
+    /** @brief Shared state: decoded image has transparent pixels. */
+    bool decoded_transparent_ = false;
+    /** @brief Shared state: decoding error. */
+    std::exception_ptr error_;
+
+    /** @brief Background decoder of the full size image. */
+    std::thread full_loader_;
+    /** @brief Full size image decoded in background. */
+    image full_;
+    /** @brief Flag indicated that full size image is ready to use. */
+    bool full_ready_ = false;
+
+    /** @brief Frame render job for the worker thread. */
+    struct render_job {
+        /** @brief Source image (pyramid level). */
+        const image* src;
+        /** @brief Size of the whole scaled image. */
+        size_t scaled_w;
+        size_t scaled_h;
+        /** @brief Area of the scaled image (the frame). */
+        size_t x;
+        size_t y;
+        size_t w;
+        size_t h;
+        /** @brief Background for transparent image. */
+        const grid* bkg;
+    };
+    /** @brief Render worker. */
+    std::thread render_thread_;
+    /** @brief Lock of the render state. */
+    std::mutex render_mutex_;
+    /** @brief Render state change notification. */
+    std::condition_variable render_cond_;
+    /** @brief The latest job, replaces the previous one. */
+    render_job render_job_;
+    /** @brief Sequence number of the latest job, used to abort stale jobs. */
+    std::atomic<size_t> render_seq_ { 0 };
+    /** @brief Flag indicated that the job is waiting for the worker. */
+    bool render_pending_ = false;
+    /** @brief Flag indicated that the worker is rendering. */
+    bool render_busy_ = false;
+    /** @brief Flag indicated that the frame has been rendered. */
+    bool render_ready_ = false;
+    /** @brief Flag used to stop the worker. */
+    bool render_stop_ = false;
+    /** @brief Frame rendered by the worker. */
+    image::buffer_t render_buf_;
 };
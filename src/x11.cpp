@@ -2,38 +2,107 @@
 // Copyright (C) 2020 Artem Senichev <artemsen@gmail.com>
 
 #include "x11.hpp"
+#include "stats.hpp"
+#include "thread_pool.hpp"
+#include "trace.hpp"
 
+#include <algorithm>
+#include <cerrno>
+#include <cstdlib>
 #include <cstring>
 #include <stdexcept>
+#include <system_error>
+
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
 
-#include <X11/Xatom.h>
 #include <X11/Xresource.h>
 
-x11::~x11()
+/** @brief Max number of damaged areas, bounding box is used for more. */
+constexpr size_t max_damage = 16;
+/** @brief Max size of the X pixmap. */
+constexpr size_t max_picture = 32767;
+
+#ifdef HAVE_LIBXEXT
+#include <sys/ipc.h>
+#include <sys/shm.h>
+
+/** @brief Flag indicated that X11 error occurred during MIT-SHM attach. */
+static bool shm_error = false;
+
+/** @brief X11 error handler used to catch MIT-SHM attach errors. */
+static int shm_error_handler(Display*, XErrorEvent*)
 {
-    if (!parent_title_.empty()) {
-        set_title(parent_title_.c_str());
-    }
-    if (gc_) {
-        XFreeGC(display_, gc_);
-    }
-    if (image_) {
-        XDestroyImage(image_);
+    shm_error = true;
+    return 0;
+}
+#endif // HAVE_LIBXEXT
+
+/** @brief Flag indicated that X11 errors are trapped (see trap_errors()). */
+static bool trap_enabled = false;
+/** @brief Description of the first trapped X11 error, empty if none. */
+static std::string trapped_error;
+
+/** @brief X11 error handler used in the error trapping mode. */
+static int trap_error_handler(Display* display, XErrorEvent* ev)
+{
+    if (trapped_error.empty()) {
+        char text[128];
+        XGetErrorText(display, ev->error_code, text, sizeof(text));
+        trapped_error = text;
     }
-    if (wnd_) {
-        XUnmapWindow(display_, wnd_);
-        XDestroyWindow(display_, wnd_);
+    return 0;
+}
+
+x11::x11()
+{
+    // pipe is ready before the window, so background threads can notify
+    // the event loop while the X connection is being set up
+    if (pipe2(notify_fd_, O_NONBLOCK | O_CLOEXEC) == -1) {
+        throw std::system_error(errno, std::system_category());
     }
+}
+
+x11::~x11()
+{
+    destroy();
+#ifdef HAVE_LIBXEXT
+    shm_free();
+#endif // HAVE_LIBXEXT
     if (display_) {
         XCloseDisplay(display_);
     }
+    for (int fd : notify_fd_) {
+        if (fd != -1) {
+            close(fd);
+        }
+    }
 }
 
-void x11::create(size_t border)
+void x11::create(size_t border, bool pixmap /*= false*/, bool xrender /*= false*/)
 {
-    display_ = XOpenDisplay(nullptr);
+    use_pixmap_ = pixmap;
+
     if (!display_) {
-        throw std::runtime_error("Unable to open X11 display");
+        // connection is kept between windows
+        display_ = XOpenDisplay(nullptr);
+        if (!display_) {
+            throw std::runtime_error("Unable to open X11 display");
+        }
+        trace("x11: display opened");
+
+        // all atoms are interned with a single round-trip
+        static const char* atom_names[] = { "_NET_WM_NAME", "UTF8_STRING" };
+        Atom atoms[2];
+        XInternAtoms(display_, const_cast<char**>(atom_names), 2, False, atoms);
+        atom_wm_name_ = atoms[0];
+        atom_utf8_ = atoms[1];
+
+#ifdef HAVE_LIBXEXT
+        shm_ = shm_init();
+        trace("x11: shared memory initialized");
+#endif // HAVE_LIBXEXT
     }
 
     // get currently focused window to use it as parent
@@ -48,21 +117,10 @@ void x11::create(size_t border)
         throw std::runtime_error("Parent window not found, try to set WINDOWID");
     }
 
-    // save current parent's title to restore them on exit
-    XTextProperty prop;
-    XGetWMName(display_, parent_, &prop);
-    if (prop.nitems > 0) {
-        int count = 0;
-        char** list = nullptr;
-        Xutf8TextPropertyToTextList(display_, &prop, &list, &count);
-        if (count) {
-            parent_title_ = list[0];
-            XFreeStringList(list);
-            XFree(prop.value);
-        }
-    }
-
     updateWindowAttributes(border);
+    check_errors(false);
+    format_init();
+    trace("x11: parent window attributes");
 
     int colorbg = getXresourceColor("picterm.background");
     if (colorbg == -1) {
@@ -76,120 +134,899 @@ void x11::create(size_t border)
     XSetForeground(display_, gc_, WhitePixel(display_, screen));
     XSetBackground(display_, gc_, BlackPixel(display_, screen));
 
+#ifdef HAVE_LIBXRENDER
+    if (xrender) {
+        xrender_init();
+        trace("x11: xrender initialized");
+    }
+#else
+    (void)xrender;
+#endif // HAVE_LIBXRENDER
+
     XMapWindow(display_, wnd_);
     XSetInputFocus(display_, wnd_, RevertToParent, CurrentTime);
+    check_errors(true);
+    trace("x11: window created");
+}
+
+void x11::destroy()
+{
+    if (!wnd_) {
+        return;
+    }
+    if (title_saved_) {
+        set_title(parent_title_.c_str());
+        title_saved_ = false;
+        parent_title_.clear();
+    }
+    XFreeGC(display_, gc_);
+    gc_ = 0;
+    destroy_image();
+    if (pixmap_) {
+        XFreePixmap(display_, pixmap_);
+        pixmap_ = 0;
+    }
+#ifdef HAVE_LIBXRENDER
+    free_source();
+    if (wnd_pic_) {
+        XRenderFreePicture(display_, wnd_pic_);
+        wnd_pic_ = 0;
+    }
+#endif // HAVE_LIBXRENDER
+    XUnmapWindow(display_, wnd_);
+    XDestroyWindow(display_, wnd_);
+    if (trap_enabled) {
+        // the parent may be already gone, the errors are not relevant
+        XSync(display_, False);
+        trapped_error.clear();
+    } else {
+        XFlush(display_);
+    }
+    wnd_ = 0;
+    parent_ = 0;
+
+    img_x_ = img_y_ = 0;
+    img_w_ = img_h_ = 0;
+    rendered_ = false;
+    damage_.clear();
+    timer_ = false;
 }
 
-void x11::set_title(const char* title) const
+void x11::trap_errors()
 {
+    trap_enabled = true;
+    XSetErrorHandler(trap_error_handler);
+}
+
+void x11::set_title(const char* title)
+{
+    if (!title_saved_) {
+        // save current parent's title to restore them on exit, it is done
+        // on demand to keep the round-trip out of the startup path
+        title_saved_ = true;
+        XTextProperty prop;
+        if (XGetWMName(display_, parent_, &prop) && prop.nitems > 0) {
+            int count = 0;
+            char** list = nullptr;
+            Xutf8TextPropertyToTextList(display_, &prop, &list, &count);
+            if (count) {
+                parent_title_ = list[0];
+                XFreeStringList(list);
+            }
+            XFree(prop.value);
+        }
+    }
+
     char* text = const_cast<char*>(title);
     unsigned char* prop = reinterpret_cast<unsigned char*>(text);
-    XChangeProperty(display_, parent_,
-        XInternAtom(display_, "_NET_WM_NAME", False),
-        XA_STRING, 8, PropModeReplace, prop, strlen(title));
+    XChangeProperty(display_, parent_, atom_wm_name_, atom_utf8_, 8,
+                    PropModeReplace, prop, strlen(title));
 }
 
-void x11::set_image(const image& img, ssize_t x, ssize_t y)
+image::rgba_t* x11::frame(size_t width, size_t height)
 {
-    // XCreateImage takes ownership of the image buffer and free it with XDestroyImage
-    const size_t img_data_sz = img.height * img.width * sizeof(image::rgba_t);
-    char* img_data = static_cast<char*>(malloc(img_data_sz));
-    if (!img_data) {
-        throw std::bad_alloc();
+    Visual* visual = visual_;
+
+    // Recreate the X image, pixel buffer is reused
+    destroy_image();
+
+#ifdef HAVE_LIBXEXT
+    if (shm_) {
+        wait_frame(); // segment is reused
+        image_ = XShmCreateImage(display_, visual, depth_, ZPixmap, nullptr,
+                                 &shm_info_, width, height);
+        if (image_) {
+            const size_t sz = image_->bytes_per_line * image_->height;
+            if (sz <= shm_size_ || shm_alloc(sz)) {
+                image_->data = shm_info_.shmaddr;
+            } else {
+                XDestroyImage(image_);
+                image_ = nullptr;
+            }
+        }
+        if (!image_) {
+            // fallback to regular XPutImage
+            shm_free();
+            shm_ = false;
+        }
     }
-    memcpy(img_data, img.data.data(), img_data_sz);
+#endif // HAVE_LIBXEXT
 
-    // get currently filled area to determine whether we need to clear the window
-    const size_t filled_x1 = img_x_ > 0 ? img_x_ : 0;
-    const size_t filled_x2 = img_x_ + img_w() > width_ ? width_ : img_x_ + img_w();
-    const size_t filled_y1 = img_y_ > 0 ? img_y_ : 0;
-    const size_t filled_y2 = img_y_ + img_h() > height_ ? height_ : img_y_ + img_h();
+    if (!image_) {
+        image_ = XCreateImage(display_, visual,
+            depth_, ZPixmap, 0, nullptr,
+            width, height, sizeof(image::rgba_t) * 8, 0);
+        if (!image_) {
+            throw std::bad_alloc();
+        }
+        const size_t sz = image_->bytes_per_line * image_->height;
+        buffer_.resize(sz / sizeof(image::rgba_t));
+        image_->data = reinterpret_cast<char*>(buffer_.data());
+    }
 
-    // Recreate the X image
-    if (image_) {
-        XDestroyImage(image_);
+    if (convert_) {
+        // frame is rendered into intermediate buffer and converted to the
+        // native format of the X image before sending
+        frame_.resize(width * height);
+        return frame_.data();
     }
-    image_ = XCreateImage(display_,
-        DefaultVisual(display_, DefaultScreen(display_)),
-        depth_, ZPixmap, 0, img_data,
-        img.width, img.height, sizeof(image::rgba_t) * 8, 0);
+    return reinterpret_cast<image::rgba_t*>(image_->data);
+}
+
+void x11::set_frame(ssize_t x, ssize_t y)
+{
+    // get currently filled area to determine whether we need to clear the window
+    const rect filled = image_area();
+
+    img_x_ = x;
+    img_y_ = y;
+    img_w_ = image_->width;
+    img_h_ = image_->height;
 
     // clear the window if new image doesn't cover the old one
-    const size_t cover_x1 = x > 0 ? x : 0;
-    const size_t cover_x2 = x + img_w() > width_ ? width_ : x + img_w();
-    const size_t cover_y1 = y > 0 ? y : 0;
-    const size_t cover_y2 = y + img_h() > height_ ? height_ : y + img_h();
-    if (cover_x1 > filled_x1 || cover_x2 < filled_x2 || cover_y1 > filled_y1 || cover_y2 < filled_y2) {
+    const rect cover = image_area();
+    if (cover.x > filled.x || cover.x + cover.w < filled.x + filled.w ||
+        cover.y > filled.y || cover.y + cover.h < filled.y + filled.h) {
         XClearWindow(display_, wnd_);
     }
 
-    move_image(x, y);
+    convert(0, 0, img_w_, img_h_);
+
+    if (use_pixmap_ && img_w_ && img_h_) {
+        // upload the frame once, the window is repainted from the pixmap
+        if (!pixmap_ || pixmap_w_ != img_w_ || pixmap_h_ != img_h_) {
+            if (pixmap_) {
+                XFreePixmap(display_, pixmap_);
+            }
+            pixmap_ = XCreatePixmap(display_, wnd_, img_w_, img_h_, depth_);
+            pixmap_w_ = img_w_;
+            pixmap_h_ = img_h_;
+        }
+        upload(0, 0, img_w_, img_h_);
+    }
+
+    // new content, the whole image must be put
+    rendered_ = false;
+    damage_.clear();
+    add_damage(cover);
+}
+
+void x11::update_frame(size_t y, size_t h)
+{
+    if (image_) {
+        convert(0, y, image_->width, h);
+        if (pixmap_) {
+            upload(0, y, image_->width, h);
+        }
+        put_image(0, y, image_->width, h);
+        XFlush(display_);
+    }
+}
+
+void x11::wait_frame()
+{
+#ifdef HAVE_LIBXEXT
+    if (shm_busy_) {
+        XSync(display_, False);
+        shm_busy_ = false;
+    }
+#endif // HAVE_LIBXEXT
+}
+
+void x11::set_image(const image& img, ssize_t x, ssize_t y)
+{
+    image::rgba_t* dst = frame(img.width, img.height);
+    memcpy(dst, img.data.data(), img.data.size() * sizeof(image::rgba_t));
+    set_frame(x, y);
 }
 
 void x11::move_image(ssize_t x, ssize_t y)
 {
+    const rect from = image_area();
+    const ssize_t dx = x - img_x_;
+    const ssize_t dy = y - img_y_;
     img_x_ = x;
     img_y_ = y;
-    redraw();
+    if (dx || dy) {
+        copy_area(from, image_area(), dx, dy);
+    }
 }
 
-void x11::run(key_handler_fn cb, bool exit_unfocus) const
+void x11::scroll_frame(ssize_t dx, ssize_t dy)
 {
-    XPutImage(display_, wnd_, gc_, image_, 0, 0, img_x_, img_y_, image_->width, image_->height);
+    // newly rendered strips of the frame
+    const rect frame { 0, 0, static_cast<ssize_t>(img_w_), static_cast<ssize_t>(img_h_) };
+    const rect moved { dx, dy, frame.w, frame.h };
+    rect strips[4];
+    const size_t count = subtract(frame, moved, strips);
+
+    if (convert_) {
+        // shift the X image the same way and convert the strips only
+        shift_image(dx, dy);
+        for (size_t i = 0; i < count; ++i) {
+            convert(strips[i].x, strips[i].y, strips[i].w, strips[i].h);
+        }
+    }
+
+    if (pixmap_) {
+        // shift the pixmap content and upload the exposed strips only
+        XCopyArea(display_, pixmap_, pixmap_, gc_, dx < 0 ? -dx : 0, dy < 0 ? -dy : 0,
+                  img_w_ - std::abs(dx), img_h_ - std::abs(dy),
+                  dx > 0 ? dx : 0, dy > 0 ? dy : 0);
+        for (size_t i = 0; i < count; ++i) {
+            upload(strips[i].x, strips[i].y, strips[i].w, strips[i].h);
+        }
+        add_damage(image_area());
+        return;
+    }
+
+    const rect area = image_area();
+    copy_area(area, area, dx, dy);
+}
+
+void x11::run(key_handler_fn cb, notify_fn notify_cb, timer_fn timer_cb,
+              flush_fn flush_cb, bool exit_unfocus)
+{
+    add_damage(image_area());
 
     XEvent event;
     XSelectInput(display_, wnd_, ExposureMask | KeyPressMask | FocusChangeMask);
+
+    pollfd fds[3];
+    fds[0].fd = ConnectionNumber(display_);
+    fds[0].events = POLLIN;
+    fds[1].fd = notify_fd_[0];
+    fds[1].events = POLLIN;
+    fds[2].fd = watch_fd_; // ignored by poll if not set
+    fds[2].events = POLLIN;
+
     while (1) {
-        XNextEvent(display_, &event);
-        if (event.type == Expose && event.xexpose.count == 0) {
-            XPutImage(display_, wnd_, gc_, image_, 0, 0, img_x_, img_y_, image_->width, image_->height);
-        } else if (event.type == KeyPress) {
-            const KeySym key = XLookupKeysym(&event.xkey, 0);
-            if (!cb(key)) {
-                break;
+        // handle all queued events as a single batch (e.g. key repeats)
+        while (XPending(display_)) {
+            XNextEvent(display_, &event);
+            if (event.type == Expose) {
+                const XExposeEvent& ex = event.xexpose;
+                add_damage(rect { ex.x, ex.y, ex.width, ex.height });
+            } else if (event.type == GraphicsExpose) {
+                // source of the copied area was obscured
+                const XGraphicsExposeEvent& ex = event.xgraphicsexpose;
+                add_damage(rect { ex.x, ex.y, ex.width, ex.height });
+            } else if (event.type == KeyPress) {
+                const KeySym key = XLookupKeysym(&event.xkey, 0);
+                if (!cb(key)) {
+                    return;
+                }
+            } else if (event.type == FocusOut && exit_unfocus) {
+                return;
             }
-        } else if (event.type == FocusOut && exit_unfocus) {
-            break;
         }
+        check_errors(false);
+
+        // render once per batch
+#ifdef ENABLE_STATS
+        const auto frame_start = std::chrono::steady_clock::now();
+#endif // ENABLE_STATS
+        flush_cb();
+        if (!damage_.empty()) {
+            draw_damage();
+            XFlush(display_);
+            if (!first_drawn_ && img_w_ && img_h_) {
+                first_drawn_ = true;
+                trace("x11: first frame drawn");
+                trace_finish();
+            }
+#ifdef ENABLE_STATS
+            stats_add(stats_stage::frame, std::chrono::steady_clock::now() - frame_start);
+#endif // ENABLE_STATS
+        }
+        STATS_FRAME();
+
+        // wait for new events, notifications or timer
+        int timeout = -1;
+        if (timer_) {
+            const auto now = std::chrono::steady_clock::now();
+            timeout = now >= timer_end_ ? 0 :
+                std::chrono::duration_cast<std::chrono::milliseconds>(timer_end_ - now).count() + 1;
+        }
+        const int rc = poll(fds, 3, timeout);
+        if (rc == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            throw std::system_error(errno, std::system_category());
+        }
+        if (fds[2].revents) {
+            return; // watched descriptor is readable or closed
+        }
+        if (fds[1].revents & POLLIN) {
+            char buf[64];
+            while (read(notify_fd_[0], buf, sizeof(buf)) > 0) {}
+            notify_cb();
+        }
+        if (timer_ && std::chrono::steady_clock::now() >= timer_end_) {
+            timer_ = false;
+            timer_cb();
+        }
+    }
+}
+
+void x11::set_timer(size_t ms)
+{
+    timer_ = true;
+    timer_end_ = std::chrono::steady_clock::now() + std::chrono::milliseconds(ms);
+}
+
+void x11::stop_timer()
+{
+    timer_ = false;
+}
+
+void x11::notify() const
+{
+    const char val = 0;
+    if (write(notify_fd_[1], &val, sizeof(val)) == -1) {
+        // pipe is full, the event loop will be woken up anyway
     }
 }
 
+void x11::sync() const
+{
+    XSync(display_, False);
+}
+
 void x11::updateWindowAttributes(size_t border)
 {
     XWindowAttributes attr;
-    XGetWindowAttributes(display_, parent_, &attr);
+    if (!XGetWindowAttributes(display_, parent_, &attr)) {
+        throw std::runtime_error("Unable to get attributes of the parent window");
+    }
     width_ = attr.width - border * 2;
     height_ = attr.height - border * 2;
     depth_ = attr.depth;
+    visual_ = attr.visual;
 }
 
-void x11::redraw() const
+void x11::format_init()
 {
-    XEvent expose;
-    memset(&expose, 0, sizeof(expose));
-    expose.type = Expose;
-    expose.xexpose.window = wnd_;
-    XSendEvent(display_, wnd_, False, ExposureMask, &expose);
+    if (visual_->c_class != TrueColor && visual_->c_class != DirectColor) {
+        throw std::runtime_error("Unsupported X visual, true color is required");
+    }
+
+    format_.bpp = 0;
+    int count = 0;
+    XPixmapFormatValues* formats = XListPixmapFormats(display_, &count);
+    for (int i = 0; i < count; ++i) {
+        if (static_cast<size_t>(formats[i].depth) == depth_) {
+            format_.bpp = formats[i].bits_per_pixel;
+            break;
+        }
+    }
+    if (formats) {
+        XFree(formats);
+    }
+    if (format_.bpp != 8 && format_.bpp != 16 && format_.bpp != 24 && format_.bpp != 32) {
+        throw std::runtime_error("Unsupported X pixmap format");
+    }
+
+    format_.msb_first = ImageByteOrder(display_) == MSBFirst;
+    format_.red_mask = visual_->red_mask;
+    format_.green_mask = visual_->green_mask;
+    format_.blue_mask = visual_->blue_mask;
+    convert_ = pixel_converter(format_);
+}
+
+void x11::convert(size_t x, size_t y, size_t w, size_t h)
+{
+    if (!convert_ || !image_ || !w || !h) {
+        return;
+    }
+    STATS_SCOPE(convert);
+    wait_frame();
+    const size_t width = image_->width;
+    const size_t stride = image_->bytes_per_line;
+    const size_t bytes = image_->bits_per_pixel / 8;
+    uint8_t* dst = reinterpret_cast<uint8_t*>(image_->data) + y * stride + x * bytes;
+    const image::rgba_t* src = frame_.data() + y * width + x;
+    thread_pool::parallel(h, [&](size_t begin, size_t end) {
+        for (size_t row = begin; row < end; ++row) {
+            convert_(format_, src + row * width, dst + row * stride, w);
+        }
+    });
 }
 
+void x11::shift_image(ssize_t dx, ssize_t dy)
+{
+    wait_frame(); // the X image is shifted in place
+    const size_t w = image_->width;
+    const size_t h = image_->height;
+    const size_t adx = std::abs(dx);
+    const size_t ady = std::abs(dy);
+    const size_t stride = image_->bytes_per_line;
+    const size_t bytes = image_->bits_per_pixel / 8;
+    const size_t row_sz = (w - adx) * bytes;
+    const size_t src_x = (dx < 0 ? adx : 0) * bytes;
+    const size_t dst_x = (dx > 0 ? adx : 0) * bytes;
+    char* data = image_->data;
+    if (dy > 0) {
+        for (size_t row = h - 1; row >= ady; --row) {
+            memmove(data + row * stride + dst_x, data + (row - ady) * stride + src_x, row_sz);
+        }
+    } else {
+        for (size_t row = 0; row < h - ady; ++row) {
+            memmove(data + row * stride + dst_x, data + (row + ady) * stride + src_x, row_sz);
+        }
+    }
+}
+
+void x11::check_errors(bool sync) const
+{
+    if (!trap_enabled) {
+        return; // default handler exits on errors
+    }
+    if (sync) {
+        XSync(display_, False);
+    }
+    if (!trapped_error.empty()) {
+        const std::string msg = "X11 error: " + trapped_error;
+        trapped_error.clear();
+        throw std::runtime_error(msg);
+    }
+}
+
+void x11::destroy_image()
+{
+    if (image_) {
+        // pixel buffer is not owned by the X image
+        image_->data = nullptr;
+        XDestroyImage(image_);
+        image_ = nullptr;
+    }
+}
+
+x11::rect x11::image_area() const
+{
+    const ssize_t x1 = std::max(img_x_, static_cast<ssize_t>(0));
+    const ssize_t y1 = std::max(img_y_, static_cast<ssize_t>(0));
+    const ssize_t x2 = std::min(img_x_ + static_cast<ssize_t>(img_w_), static_cast<ssize_t>(width_));
+    const ssize_t y2 = std::min(img_y_ + static_cast<ssize_t>(img_h_), static_cast<ssize_t>(height_));
+    return rect { x1, y1, std::max(x2 - x1, static_cast<ssize_t>(0)),
+                  std::max(y2 - y1, static_cast<ssize_t>(0)) };
+}
+
+void x11::add_damage(const rect& rc)
+{
+    if (rc.w <= 0 || rc.h <= 0) {
+        return;
+    }
+    if (damage_.size() < max_damage) {
+        damage_.push_back(rc);
+        return;
+    }
+    // too many areas, merge them into the bounding box
+    rect& box = damage_.front();
+    for (auto& it : damage_) {
+        const ssize_t x2 = std::max(box.x + box.w, it.x + it.w);
+        const ssize_t y2 = std::max(box.y + box.h, it.y + it.h);
+        box.x = std::min(box.x, it.x);
+        box.y = std::min(box.y, it.y);
+        box.w = x2 - box.x;
+        box.h = y2 - box.y;
+    }
+    const ssize_t x2 = std::max(box.x + box.w, rc.x + rc.w);
+    const ssize_t y2 = std::max(box.y + box.h, rc.y + rc.h);
+    box.x = std::min(box.x, rc.x);
+    box.y = std::min(box.y, rc.y);
+    box.w = x2 - box.x;
+    box.h = y2 - box.y;
+    damage_.resize(1);
+}
+
+void x11::draw_damage()
+{
+#ifdef HAVE_LIBXRENDER
+    if (rendered_) {
+        for (auto& it : damage_) {
+            const rect rc = intersect(it, image_area());
+            if (rc.w > 0 && rc.h > 0) {
+                composite(rc.x - img_x_, rc.y - img_y_, rc.w, rc.h);
+            }
+        }
+        damage_.clear();
+        return;
+    }
+#endif // HAVE_LIBXRENDER
+
+    if (image_) {
+        for (auto& it : damage_) {
+            // area on the image
+            const ssize_t x = std::max(it.x - img_x_, static_cast<ssize_t>(0));
+            const ssize_t y = std::max(it.y - img_y_, static_cast<ssize_t>(0));
+            const ssize_t x2 = std::min(it.x + it.w - img_x_, static_cast<ssize_t>(img_w_));
+            const ssize_t y2 = std::min(it.y + it.h - img_y_, static_cast<ssize_t>(img_h_));
+            if (x >= x2 || y >= y2) {
+                continue;
+            }
+            if (pixmap_) {
+                // server-side copy, no pixels are sent
+                XCopyArea(display_, pixmap_, wnd_, gc_, x, y, x2 - x, y2 - y,
+                          img_x_ + x, img_y_ + y);
+            } else {
+                put_image(x, y, x2 - x, y2 - y);
+            }
+        }
+    }
+    damage_.clear();
+}
+
+x11::rect x11::intersect(const rect& a, const rect& b)
+{
+    const ssize_t x1 = std::max(a.x, b.x);
+    const ssize_t y1 = std::max(a.y, b.y);
+    const ssize_t x2 = std::min(a.x + a.w, b.x + b.w);
+    const ssize_t y2 = std::min(a.y + a.h, b.y + b.h);
+    return rect { x1, y1, std::max(x2 - x1, static_cast<ssize_t>(0)),
+                  std::max(y2 - y1, static_cast<ssize_t>(0)) };
+}
+
+size_t x11::subtract(const rect& a, const rect& b, rect* out)
+{
+    const ssize_t ix1 = std::max(a.x, b.x);
+    const ssize_t iy1 = std::max(a.y, b.y);
+    const ssize_t ix2 = std::min(a.x + a.w, b.x + b.w);
+    const ssize_t iy2 = std::min(a.y + a.h, b.y + b.h);
+    if (a.w <= 0 || a.h <= 0) {
+        return 0;
+    }
+    if (ix1 >= ix2 || iy1 >= iy2) {
+        out[0] = a; // no intersection
+        return 1;
+    }
+    size_t n = 0;
+    if (iy1 > a.y) {
+        out[n++] = rect { a.x, a.y, a.w, iy1 - a.y };
+    }
+    if (iy2 < a.y + a.h) {
+        out[n++] = rect { a.x, iy2, a.w, a.y + a.h - iy2 };
+    }
+    if (ix1 > a.x) {
+        out[n++] = rect { a.x, iy1, ix1 - a.x, iy2 - iy1 };
+    }
+    if (ix2 < a.x + a.w) {
+        out[n++] = rect { ix2, iy1, a.x + a.w - ix2, iy2 - iy1 };
+    }
+    return n;
+}
+
+void x11::copy_area(const rect& from, const rect& to, ssize_t dx, ssize_t dy)
+{
+    if (pixmap_ || rendered_) {
+        // repaint from the pixmap, it is cheaper than copying on the window
+        rect strips[4];
+        const size_t count = subtract(from, to, strips);
+        for (size_t i = 0; i < count; ++i) {
+            XClearArea(display_, wnd_, strips[i].x, strips[i].y, strips[i].w, strips[i].h, False);
+        }
+        add_damage(to);
+        return;
+    }
+
+    // window must be up to date before copying its content
+    draw_damage();
+
+    // visible content that stays visible after the shift
+    const ssize_t x1 = std::max(from.x, to.x - dx);
+    const ssize_t y1 = std::max(from.y, to.y - dy);
+    const ssize_t x2 = std::min(from.x + from.w, to.x + to.w - dx);
+    const ssize_t y2 = std::min(from.y + from.h, to.y + to.h - dy);
+
+    rect strips[4];
+    size_t count;
+    if (x1 < x2 && y1 < y2) {
+        XCopyArea(display_, wnd_, wnd_, gc_, x1, y1, x2 - x1, y2 - y1, x1 + dx, y1 + dy);
+        count = subtract(to, rect { x1 + dx, y1 + dy, x2 - x1, y2 - y1 }, strips);
+    } else {
+        strips[0] = to;
+        count = 1;
+    }
+    for (size_t i = 0; i < count; ++i) {
+        add_damage(strips[i]);
+    }
+
+    // clear the area that is not covered by the image anymore
+    count = subtract(from, to, strips);
+    for (size_t i = 0; i < count; ++i) {
+        XClearArea(display_, wnd_, strips[i].x, strips[i].y, strips[i].w, strips[i].h, False);
+    }
+}
+
+void x11::upload(size_t x, size_t y, size_t w, size_t h) const
+{
+    STATS_SCOPE(put);
+#ifdef HAVE_LIBXEXT
+    if (shm_) {
+        XShmPutImage(display_, pixmap_, gc_, image_, x, y, x, y, w, h, False);
+        shm_busy_ = true;
+        return;
+    }
+#endif // HAVE_LIBXEXT
+    XPutImage(display_, pixmap_, gc_, image_, x, y, x, y, w, h);
+}
+
+void x11::put_image(size_t x, size_t y, size_t w, size_t h) const
+{
+    STATS_SCOPE(put);
+    // clip by the window, invisible part of the image is not sent
+    const ssize_t x1 = std::max(static_cast<ssize_t>(x), -img_x_);
+    const ssize_t y1 = std::max(static_cast<ssize_t>(y), -img_y_);
+    const ssize_t x2 = std::min(static_cast<ssize_t>(x + w), static_cast<ssize_t>(width_) - img_x_);
+    const ssize_t y2 = std::min(static_cast<ssize_t>(y + h), static_cast<ssize_t>(height_) - img_y_);
+    if (x1 >= x2 || y1 >= y2) {
+        return;
+    }
+
+#ifdef HAVE_LIBXEXT
+    if (shm_) {
+        XShmPutImage(display_, wnd_, gc_, image_, x1, y1, img_x_ + x1, img_y_ + y1,
+                     x2 - x1, y2 - y1, False);
+        shm_busy_ = true;
+        return;
+    }
+#endif // HAVE_LIBXEXT
+    XPutImage(display_, wnd_, gc_, image_, x1, y1, img_x_ + x1, img_y_ + y1,
+              x2 - x1, y2 - y1);
+}
+
+bool x11::set_source(const image& img, const image* bkg)
+{
+#ifdef HAVE_LIBXRENDER
+    free_source();
+    if (!wnd_pic_ || !img.width || !img.height ||
+        img.width > max_picture || img.height > max_picture) {
+        return false;
+    }
+
+    XRenderPictureAttributes attr;
+    // repeat edge pixels to avoid fading of the borders by bilinear filter
+    attr.repeat = RepeatPad;
+    src_pic_ = create_picture(img, src_pix_, CPRepeat, attr);
+    if (bkg) {
+        attr.repeat = RepeatNormal;
+        bkg_pic_ = create_picture(*bkg, bkg_pix_, CPRepeat, attr);
+    }
+    src_w_ = img.width;
+    src_h_ = img.height;
+    return true;
+#else
+    (void)img;
+    (void)bkg;
+    return false;
+#endif // HAVE_LIBXRENDER
+}
+
+void x11::render(ssize_t x, ssize_t y, size_t w, size_t h, bool smooth)
+{
+#ifdef HAVE_LIBXRENDER
+    if (!src_pic_ || !w || !h) {
+        return;
+    }
+
+    const rect filled = image_area();
+    img_x_ = x;
+    img_y_ = y;
+    img_w_ = w;
+    img_h_ = h;
+    const rect cover = image_area();
+    if (cover.x > filled.x || cover.x + cover.w < filled.x + filled.w ||
+        cover.y > filled.y || cover.y + cover.h < filled.y + filled.h) {
+        XClearWindow(display_, wnd_);
+    }
+
+    // scale is a transform of the source picture, no pixels are sent
+    XTransform xf;
+    memset(&xf, 0, sizeof(xf));
+    xf.matrix[0][0] = XDoubleToFixed(static_cast<double>(src_w_) / w);
+    xf.matrix[1][1] = XDoubleToFixed(static_cast<double>(src_h_) / h);
+    xf.matrix[2][2] = XDoubleToFixed(1);
+    XRenderSetPictureTransform(display_, src_pic_, &xf);
+    const char* filter = smooth ? FilterBilinear : FilterNearest;
+    XRenderSetPictureFilter(display_, src_pic_, filter, nullptr, 0);
+
+    rendered_ = true;
+    damage_.clear();
+    add_damage(cover);
+#else
+    (void)x;
+    (void)y;
+    (void)w;
+    (void)h;
+    (void)smooth;
+#endif // HAVE_LIBXRENDER
+}
+
+#ifdef HAVE_LIBXRENDER
+void x11::xrender_init()
+{
+    int event, error;
+    if (!XRenderQueryExtension(display_, &event, &error)) {
+        return;
+    }
+    XRenderPictFormat* fmt = XRenderFindVisualFormat(display_, visual_);
+    if (fmt) {
+        wnd_pic_ = XRenderCreatePicture(display_, wnd_, fmt, 0, nullptr);
+    }
+}
+
+Picture x11::create_picture(const image& img, Pixmap& pix,
+                            unsigned long mask, const XRenderPictureAttributes& attr)
+{
+    // XRender uses premultiplied alpha
+    std::vector<image::rgba_t> premul;
+    const image::rgba_t* data = img.data.data();
+    if (img.transparent) {
+        premul.resize(img.data.size());
+        for (size_t i = 0; i < premul.size(); ++i) {
+            const image::rgba_t px = data[i];
+            const uint32_t a = px >> 24;
+            const uint32_t rb = ((px & 0xff00ff) * a + 0x800080) >> 8 & 0xff00ff;
+            const uint32_t g = ((px & 0x00ff00) * a + 0x008000) >> 8 & 0x00ff00;
+            premul[i] = (px & 0xff000000) | rb | g;
+        }
+        data = premul.data();
+    }
+
+    pix = XCreatePixmap(display_, wnd_, img.width, img.height, 32);
+    GC gc = XCreateGC(display_, pix, 0, nullptr);
+    Visual* visual = DefaultVisual(display_, DefaultScreen(display_));
+    XImage* xi = XCreateImage(display_, visual, 32, ZPixmap, 0,
+                              reinterpret_cast<char*>(const_cast<image::rgba_t*>(data)),
+                              img.width, img.height, 32, 0);
+    if (xi) {
+        XPutImage(display_, pix, gc, xi, 0, 0, 0, 0, img.width, img.height);
+        xi->data = nullptr; // pixel buffer is not owned by the X image
+        XDestroyImage(xi);
+    }
+    XFreeGC(display_, gc);
+
+    XRenderPictFormat* fmt = XRenderFindStandardFormat(display_, PictStandardARGB32);
+    return XRenderCreatePicture(display_, pix, fmt, mask, &attr);
+}
+
+void x11::free_source()
+{
+    if (src_pic_) {
+        XRenderFreePicture(display_, src_pic_);
+        XFreePixmap(display_, src_pix_);
+        src_pic_ = 0;
+        src_pix_ = 0;
+    }
+    if (bkg_pic_) {
+        XRenderFreePicture(display_, bkg_pic_);
+        XFreePixmap(display_, bkg_pix_);
+        bkg_pic_ = 0;
+        bkg_pix_ = 0;
+    }
+    rendered_ = false;
+}
+
+void x11::composite(ssize_t x, ssize_t y, size_t w, size_t h) const
+{
+    const ssize_t dst_x = img_x_ + x;
+    const ssize_t dst_y = img_y_ + y;
+    if (bkg_pic_) {
+        XRenderComposite(display_, PictOpSrc, bkg_pic_, None, wnd_pic_,
+                         x, y, 0, 0, dst_x, dst_y, w, h);
+        XRenderComposite(display_, PictOpOver, src_pic_, None, wnd_pic_,
+                         x, y, 0, 0, dst_x, dst_y, w, h);
+    } else {
+        XRenderComposite(display_, PictOpSrc, src_pic_, None, wnd_pic_,
+                         x, y, 0, 0, dst_x, dst_y, w, h);
+    }
+}
+#endif // HAVE_LIBXRENDER
+
 int x11::getXresourceColor(const char* color) const
 {
-    XrmInitialize();
-    char* resource_manager = XResourceManagerString(display_);
-    if (!resource_manager) {
+    // resources are received with the connection setup, skip parsing
+    // of the whole database if there are no our resources
+    const char* resource_manager = XResourceManagerString(display_);
+    if (!resource_manager || !strstr(resource_manager, "picterm")) {
         return -1;
     }
 
+    XrmInitialize();
     XrmDatabase db = XrmGetStringDatabase(resource_manager);
     if (!db) {
         return -1;
     }
 
+    int rc = -1;
     XrmValue value;
     char *type;
     if (XrmGetResource(db, color, "", &type, &value)) {
-        return strtol(value.addr + 1, NULL, 16); // first char is '#'
-    } else {
-        return -1;
+        rc = strtol(value.addr + 1, NULL, 16); // first char is '#'
+    }
+    XrmDestroyDatabase(db);
+    return rc;
+}
+
+#ifdef HAVE_LIBXEXT
+bool x11::shm_init()
+{
+    const char* off = getenv("PICTERM_NO_SHM"); // used to compare transports
+    if ((off && *off) || !XShmQueryExtension(display_)) {
+        return false;
+    }
+
+    // shared memory is not accessible for remote X servers
+    const char* name = DisplayString(display_);
+    return name && (*name == ':' || strncmp(name, "unix:", 5) == 0);
+}
+
+bool x11::shm_alloc(size_t size)
+{
+    shm_free();
+
+    shm_info_.shmid = shmget(IPC_PRIVATE, size, IPC_CREAT | 0600);
+    if (shm_info_.shmid == -1) {
+        return false;
+    }
+    shm_info_.shmaddr = static_cast<char*>(shmat(shm_info_.shmid, nullptr, 0));
+    if (shm_info_.shmaddr == reinterpret_cast<char*>(-1)) {
+        shmctl(shm_info_.shmid, IPC_RMID, nullptr);
+        return false;
+    }
+    shm_info_.readOnly = True;
+
+    // attach fails with BadAccess if server can't access the segment
+    XSync(display_, False);
+    shm_error = false;
+    XErrorHandler handler = XSetErrorHandler(shm_error_handler);
+    const Status attached = XShmAttach(display_, &shm_info_);
+    XSync(display_, False);
+    XSetErrorHandler(handler);
+
+    // segment will be destroyed after the last detach
+    shmctl(shm_info_.shmid, IPC_RMID, nullptr);
+
+    if (!attached || shm_error) {
+        shmdt(shm_info_.shmaddr);
+        return false;
+    }
+
+    shm_size_ = size;
+    pixels_account(shm_size_, true);
+    return true;
+}
+
+void x11::shm_free()
+{
+    if (shm_size_) {
+        XShmDetach(display_, &shm_info_);
+        XSync(display_, False);
+        shmdt(shm_info_.shmaddr);
+        pixels_account(shm_size_, false);
+        shm_size_ = 0;
+        shm_busy_ = false;
     }
 }
+#endif // HAVE_LIBXEXT
@@ -4,12 +4,20 @@
 #pragma once
 
 #include "image.hpp"
+#include "pixel_format.hpp"
 
+#include <chrono>
 #include <string>
 #include <functional>
 
 #include <X11/Xlib.h>
 #include <X11/Xutil.h>
+#ifdef HAVE_LIBXEXT
+#include <X11/extensions/XShm.h>
+#endif // HAVE_LIBXEXT
+#ifdef HAVE_LIBXRENDER
+#include <X11/extensions/Xrender.h>
+#endif // HAVE_LIBXRENDER
 
 /**
  * @class x11
@@ -26,23 +34,107 @@ public:
      */
     using key_handler_fn = std::function<bool(KeySym)>;
 
+    /**
+     * @brief Callback for notification from other threads (see notify()).
+     */
+    using notify_fn = std::function<void()>;
+
+    /**
+     * @brief Callback for timer expiration (see set_timer()).
+     */
+    using timer_fn = std::function<void()>;
+
+    /**
+     * @brief Callback called after each batch of events has been handled,
+     *        used to render the result of the batch at once.
+     */
+    using flush_fn = std::function<void()>;
+
+    /**
+     * @brief Constructor: create notification pipe (see notify()).
+     *
+     * @throw std::system_error in case of errors
+     */
+    x11();
+
     ~x11();
 
     /**
      * @brief Create X11 window.
      *
      * @param[in] border space between parent and this window
+     * @param[in] pixmap keep the frame in the server-side pixmap, so the
+     *                   window is repainted without sending pixels again
+     * @param[in] xrender use XRender extension to scale and composite
+     *                    the image on the server side
      *
      * @throw std::runtime_error in case of errors
      */
-    void create(size_t border);
+    void create(size_t border, bool pixmap = false, bool xrender = false);
+
+    /**
+     * @brief Destroy the window, the X connection is kept to create the
+     *        next window faster.
+     */
+    void destroy();
+
+    /**
+     * @brief Catch X11 protocol errors instead of exiting the process (the
+     *        default Xlib behavior), used by the long-running daemon: errors
+     *        are reported as exceptions by create() and run().
+     */
+    static void trap_errors();
+
+    /**
+     * @brief Set file descriptor to watch: event loop is stopped as soon as
+     *        it becomes readable or closed.
+     *
+     * @param[in] fd file descriptor, -1 to stop watching
+     */
+    inline void watch(int fd) { watch_fd_ = fd; }
 
     /**
      * @brief Set window title.
      *
      * @param[in] title new parent's window title
      */
-    void set_title(const char* title) const;
+    void set_title(const char* title);
+
+    /**
+     * @brief Get pixel buffer for the new frame. The buffer is owned by the
+     *        X image and it is reused between the frames, so the frame can be
+     *        rendered directly into it without intermediate copies.
+     *
+     * @param[in] width width of the frame
+     * @param[in] height height of the frame
+     *
+     * @return pointer to the frame buffer (row stride is equal to width)
+     */
+    image::rgba_t* frame(size_t width, size_t height);
+
+    /**
+     * @brief Show the frame prepared in the buffer returned by frame().
+     *
+     * @param[in] x initial X coordinate of image on window (top-left corner)
+     * @param[in] y initial Y coordinate of image on window (top-left corner)
+     */
+    void set_frame(ssize_t x, ssize_t y);
+
+    /**
+     * @brief Put the part of the current frame to the window after it was
+     *        changed in the buffer returned by frame().
+     *
+     * @param[in] y first row of the frame to update
+     * @param[in] h number of rows to update
+     */
+    void update_frame(size_t y, size_t h);
+
+    /**
+     * @brief Wait until the server has read the frame buffer: with MIT-SHM
+     *        the buffer is shared with the server, it must not be changed
+     *        while the previous put request is in progress.
+     */
+    void wait_frame();
 
     /**
      * @brief Set new image for drawing.
@@ -54,23 +146,114 @@ public:
     void set_image(const image& img, ssize_t x, ssize_t y);
 
     /**
-     * @brief Move image to the new position.
+     * @brief Move image to the new position: the visible content is copied
+     *        on the window, only the newly exposed area is put at the end of
+     *        the current events batch.
      *
      * @param[in] x new X coordinate of image on window (top-left corner)
      * @param[in] y new Y coordinate of image on window (top-left corner)
      */
     void move_image(ssize_t x, ssize_t y);
 
+    /**
+     * @brief Scroll the frame content: the caller has already shifted pixels
+     *        in the frame buffer and rendered the new strips, the visible
+     *        content is copied on the window and only the strips are put.
+     *
+     * @param[in] dx horizontal shift of the content
+     * @param[in] dy vertical shift of the content
+     */
+    void scroll_frame(ssize_t dx, ssize_t dy);
+
+    /**
+     * @brief Check if the XRender extension is available and enabled.
+     *
+     * @return true if the image can be rendered with render()
+     */
+#ifdef HAVE_LIBXRENDER
+    inline bool xrender() const { return wnd_pic_ != 0; }
+#else
+    inline bool xrender() const { return false; }
+#endif // HAVE_LIBXRENDER
+
+    /**
+     * @brief Upload the full size image to the server for rendering with
+     *        render(), the previous one is released.
+     *
+     * @param[in] img source image
+     * @param[in] bkg background tile for transparent images, nullptr if
+     *                the image must be drawn as is
+     *
+     * @return false if XRender can not be used for this image
+     */
+    bool set_source(const image& img, const image* bkg);
+
+    /**
+     * @brief Show the source image scaled by the server.
+     *
+     * @param[in] x X coordinate of the scaled image on window
+     * @param[in] y Y coordinate of the scaled image on window
+     * @param[in] w width of the scaled image
+     * @param[in] h height of the scaled image
+     * @param[in] smooth use bilinear filter instead of nearest neighbor
+     */
+    void render(ssize_t x, ssize_t y, size_t w, size_t h, bool smooth);
+
     /**
      * @brief Run event loop.
      *
      * @param[in] cb callback for key press events
+     * @param[in] notify_cb callback for notifications from other threads
+     * @param[in] timer_cb callback for timer expiration
+     * @param[in] flush_cb callback for the end of events batch
      * @param[in] exit_unfocus exit loop if the window has lost input focus
      */
-    void run(key_handler_fn cb, bool exit_unfocus) const;
+    void run(key_handler_fn cb, notify_fn notify_cb, timer_fn timer_cb,
+             flush_fn flush_cb, bool exit_unfocus);
 
+    /**
+     * @brief Start one-shot timer, replaces the previous one.
+     *
+     * @param[in] ms timeout in milliseconds
+     */
+    void set_timer(size_t ms);
+
+    /**
+     * @brief Stop the timer.
+     */
+    void stop_timer();
+
+    /**
+     * @brief Wake up the event loop and call the notification callback
+     *        from its thread. Can be called from any thread.
+     */
+    void notify() const;
+
+    /**
+     * @brief Wait until all requests have been processed by the X server.
+     */
+    void sync() const;
+
+    /**
+     * @brief Update size and visual of the parent window.
+     *
+     * @param[in] border space between parent and this window
+     *
+     * @throw std::runtime_error if the parent window is not accessible
+     */
     void updateWindowAttributes(size_t border);
 
+    /**
+     * @brief Check if the frames are sent via MIT-SHM.
+     *
+     * @return false if regular XPutImage is used
+     */
+#ifdef HAVE_LIBXEXT
+    inline bool shm() const { return shm_; }
+#else
+    inline bool shm() const { return false; }
+#endif // HAVE_LIBXEXT
+
     /** @brief Get width of the window. */
     inline size_t width() const { return width_; }
     /** @brief Get height of the window. */
@@ -81,17 +264,191 @@ public:
     /** @brief Get Y coordinate of image on window (top-left corner). */
     inline ssize_t img_y() const { return img_y_; }
     /** @brief Get width of the image. */
-    inline size_t img_w() const { return image_ ? image_->width : 0; }
+    inline size_t img_w() const { return img_w_; }
     /** @brief Get height of the image. */
-    inline size_t img_h() const { return image_ ? image_->height : 0; }
+    inline size_t img_h() const { return img_h_; }
 
 private:
+    /** @brief Rectangle on the window. */
+    struct rect {
+        ssize_t x;
+        ssize_t y;
+        ssize_t w;
+        ssize_t h;
+    };
+
     /**
-     * @brief Send expose event to redraw the window.
+     * @brief Detect the native pixel format of the window visual.
+     *
+     * @throw std::runtime_error if the visual is not supported
      */
-    void redraw() const;
+    void format_init();
+
+    /**
+     * @brief Convert the part of the frame to the native format of the
+     *        X image, does nothing if the conversion is not required.
+     *
+     * @param[in] x left coordinate of the area on the frame
+     * @param[in] y top coordinate of the area on the frame
+     * @param[in] w width of the area
+     * @param[in] h height of the area
+     */
+    void convert(size_t x, size_t y, size_t w, size_t h);
+
+    /**
+     * @brief Shift content of the X image (see scroll_frame()).
+     *
+     * @param[in] dx horizontal shift of the content
+     * @param[in] dy vertical shift of the content
+     */
+    void shift_image(ssize_t dx, ssize_t dy);
+
+    /**
+     * @brief Put the part of the image to the server-side pixmap.
+     *
+     * @param[in] x left coordinate of the area on the image
+     * @param[in] y top coordinate of the area on the image
+     * @param[in] w width of the area
+     * @param[in] h height of the area
+     */
+    void upload(size_t x, size_t y, size_t w, size_t h) const;
+
+    /**
+     * @brief Get area of the window covered by the image.
+     *
+     * @return visible area of the image in window coordinates
+     */
+    rect image_area() const;
+
+    /**
+     * @brief Add area of the window to repaint.
+     *
+     * @param[in] rc area in window coordinates
+     */
+    void add_damage(const rect& rc);
+
+    /**
+     * @brief Repaint damaged areas of the window.
+     */
+    void draw_damage();
+
+    /**
+     * @brief Get intersection of two rectangles.
+     *
+     * @param[in] a first rectangle
+     * @param[in] b second rectangle
+     *
+     * @return intersection, empty if rectangles don't overlap
+     */
+    static rect intersect(const rect& a, const rect& b);
+
+    /**
+     * @brief Get parts of the first rectangle not covered by the second one.
+     *
+     * @param[in] a first rectangle
+     * @param[in] b second rectangle
+     * @param[out] out up to 4 rectangles: top, bottom, left and right strips
+     *
+     * @return number of rectangles
+     */
+    static size_t subtract(const rect& a, const rect& b, rect* out);
+
+    /**
+     * @brief Copy visible content of the image on the window and mark the
+     *        newly exposed area as damaged.
+     *
+     * @param[in] from area covered by the image before the shift
+     * @param[in] to area covered by the image after the shift
+     * @param[in] dx horizontal shift of the content
+     * @param[in] dy vertical shift of the content
+     */
+    void copy_area(const rect& from, const rect& to, ssize_t dx, ssize_t dy);
+
+    /**
+     * @brief Put the part of the image to the window, the area is clipped
+     *        by the window.
+     *
+     * @param[in] x left coordinate of the area on the image
+     * @param[in] y top coordinate of the area on the image
+     * @param[in] w width of the area
+     * @param[in] h height of the area
+     */
+    void put_image(size_t x, size_t y, size_t w, size_t h) const;
+
+    /**
+     * @brief Free the X image descriptor.
+     */
+    void destroy_image();
+
+    /**
+     * @brief Throw exception if X11 error was caught (see trap_errors()).
+     *
+     * @param[in] sync wait for the server to process all requests first
+     *
+     * @throw std::runtime_error with the error description
+     */
+    void check_errors(bool sync) const;
+
     int getXresourceColor(const char* color) const;
 
+#ifdef HAVE_LIBXEXT
+    /**
+     * @brief Initialize MIT-SHM extension.
+     *
+     * @return true if shared memory can be used for drawing
+     */
+    bool shm_init();
+
+    /**
+     * @brief Allocate shared memory segment.
+     *
+     * @param[in] size required size of the segment in bytes
+     *
+     * @return true if segment was successfully allocated and attached
+     */
+    bool shm_alloc(size_t size);
+
+    /**
+     * @brief Detach and free shared memory segment.
+     */
+    void shm_free();
+#endif // HAVE_LIBXEXT
+
+#ifdef HAVE_LIBXRENDER
+    /**
+     * @brief Initialize XRender extension.
+     */
+    void xrender_init();
+
+    /**
+     * @brief Create 32-bit pixmap with the image and XRender picture for it.
+     *
+     * @param[in] img source image
+     * @param[out] pix created pixmap
+     * @param[in] mask picture attributes mask
+     * @param[in] attr picture attributes
+     *
+     * @return picture handle
+     */
+    Picture create_picture(const image& img, Pixmap& pix, unsigned long mask,
+                           const XRenderPictureAttributes& attr);
+
+    /**
+     * @brief Free source and background pictures.
+     */
+    void free_source();
+
+    /**
+     * @brief Composite the part of the scaled image on the window.
+     *
+     * @param[in] x left coordinate of the area on the scaled image
+     * @param[in] y top coordinate of the area on the scaled image
+     * @param[in] w width of the area
+     * @param[in] h height of the area
+     */
+    void composite(ssize_t x, ssize_t y, size_t w, size_t h) const;
+#endif // HAVE_LIBXRENDER
+
 private:
     /** @brief X11 display. */
     Display* display_ = nullptr;
@@ -107,14 +464,83 @@ private:
     size_t height_ = 0;
     /** @brief Color depth. */
     size_t depth_ = 0;
+    /** @brief Visual of the window. */
+    Visual* visual_ = nullptr;
+    /** @brief Native pixel format of the visual. */
+    pixel_format format_;
+    /** @brief Conversion kernel, nullptr if the frame is sent as is. */
+    pixel_convert_fn convert_ = nullptr;
 
     /** @brief X11 image descriptor. */
     XImage* image_ = nullptr;
+    /** @brief Pixel buffer of the X image (if shared memory is not used). */
+    image::buffer_t buffer_;
+    /** @brief Frame buffer used if the pixels must be converted. */
+    image::buffer_t frame_;
     /** @brief X coordinate of image on window (top-left corner). */
     ssize_t img_x_ = 0;
     /** @brief Y coordinate of image on window (top-left corner). */
     ssize_t img_y_ = 0;
+    /** @brief Width of the image currently shown. */
+    size_t img_w_ = 0;
+    /** @brief Height of the image currently shown. */
+    size_t img_h_ = 0;
+    /** @brief Flag indicated that the frame is kept in the server-side pixmap. */
+    bool use_pixmap_ = false;
+    /** @brief Server-side copy of the frame. */
+    Pixmap pixmap_ = 0;
+    /** @brief Size of the pixmap. */
+    size_t pixmap_w_ = 0;
+    size_t pixmap_h_ = 0;
+
+    /** @brief Flag indicated that the image is rendered by XRender. */
+    bool rendered_ = false;
+
+    /** @brief Areas of the window to repaint (window coordinates). */
+    std::vector<rect> damage_;
 
     /** @brief Original title of parent window. */
     std::string parent_title_;
+    /** @brief Flag indicated that the original title was saved. */
+    bool title_saved_ = false;
+    /** @brief Atoms used to set the title. */
+    Atom atom_wm_name_ = 0;
+    Atom atom_utf8_ = 0;
+    /** @brief Flag indicated that the first frame was drawn (startup trace). */
+    bool first_drawn_ = false;
+
+    /** @brief Pipe used to wake up the event loop: read and write ends. */
+    int notify_fd_[2] = { -1, -1 };
+    /** @brief Descriptor that stops the event loop (see watch()). */
+    int watch_fd_ = -1;
+
+    /** @brief Flag indicated that the timer is started. */
+    bool timer_ = false;
+    /** @brief Timer expiration time. */
+    std::chrono::steady_clock::time_point timer_end_;
+
+#ifdef HAVE_LIBXEXT
+    /** @brief Flag indicated that MIT-SHM extension is used. */
+    bool shm_ = false;
+    /** @brief Shared memory segment descriptor. */
+    XShmSegmentInfo shm_info_;
+    /** @brief Size of the shared memory segment. */
+    size_t shm_size_ = 0;
+    /** @brief Flag indicated that MIT-SHM put request is not completed yet. */
+    mutable bool shm_busy_ = false;
+#endif // HAVE_LIBXEXT
+
+#ifdef HAVE_LIBXRENDER
+    /** @brief XRender picture of the window. */
+    Picture wnd_pic_ = 0;
+    /** @brief Full size source image on the server. */
+    Pixmap src_pix_ = 0;
+    Picture src_pic_ = 0;
+    /** @brief Background tile for transparent images. */
+    Pixmap bkg_pix_ = 0;
+    Picture bkg_pic_ = 0;
+    /** @brief Size of the source image. */
+    size_t src_w_ = 0;
+    size_t src_h_ = 0;
+#endif // HAVE_LIBXRENDER
 };
@@ -0,0 +1,55 @@
+#!/bin/sh
+# SPDX-License-Identifier: Apache-2.0
+# Copyright (C) 2020 Artem Senichev <artemsen@gmail.com>
+#
+# Daemon mode: show the same file twice, the second request is served from
+# the image cache, then request preview in a nonexistent window: the daemon
+# must report the error and keep running. Requires X display, skipped otherwise.
+
+PICTERM="${PICTERM:-./picterm}"
+
+if [ -z "${DISPLAY}" ] || ! command -v xwininfo > /dev/null; then
+    echo "X display or xwininfo not available"
+    exit 77
+fi
+
+WINDOWID=$(xwininfo -root | awk '/Window id:/ { print $4 }')
+XDG_RUNTIME_DIR=$(mktemp -d)
+export WINDOWID XDG_RUNTIME_DIR
+trap 'kill ${DAEMON} 2> /dev/null; rm -rf "${XDG_RUNTIME_DIR}"' EXIT
+
+# 2x2 QOI image: red pixel repeated by run
+IMAGE="${XDG_RUNTIME_DIR}/test.qoi"
+printf 'qoif\0\0\0\2\0\0\0\2\3\0\376\377\0\0\302\0\0\0\0\0\0\0\1' > "${IMAGE}"
+
+"${PICTERM}" --daemon &
+DAEMON=$!
+for i in 1 2 3 4 5 6 7 8 9 10; do
+    [ -S "${XDG_RUNTIME_DIR}/picterm.sock" ] && break
+    sleep 0.2
+done
+
+for i in 1 2; do
+    "${PICTERM}" --client "${IMAGE}" &
+    CLIENT=$!
+    sleep 1
+    # window is closed by the daemon as soon as the client is gone
+    kill ${CLIENT}
+    wait ${CLIENT} 2> /dev/null
+    if ! kill -0 ${DAEMON} 2> /dev/null; then
+        echo "Daemon died on request ${i}"
+        exit 1
+    fi
+done
+
+# invalid parent window: BadWindow is reported to the client
+if WINDOWID=536870911 "${PICTERM}" --client "${IMAGE}"; then
+    echo "Invalid window accepted"
+    exit 1
+fi
+if ! kill -0 ${DAEMON} 2> /dev/null; then
+    echo "Daemon died on invalid window"
+    exit 1
+fi
+
+exit 0